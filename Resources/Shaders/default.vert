@@ -1,12 +1,27 @@
-#version 410 core
+#version 450 core
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 normal;
 
+// Per mesh constants from Mesh::DrawBasic, undo the vertex quantization (see vertex_format.h)
+layout (location = 3) in vec4 decodeOffset; // xyz position offset, w = 1 for octahedral normals
+layout (location = 4) in vec3 decodeScale;
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// Per frame camera, shared by every program (see CameraBlock in uniform_blocks.h)
+layout (std140, binding = 0) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+vec3 decodePosition()
+{
+	return decodeOffset.xyz + pos * decodeScale;
+}
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(pos, 1.0f);
+	gl_Position = projection * view * model * vec4(decodePosition(), 1.0f);
 }
\ No newline at end of file
@@ -1,8 +1,15 @@
 #version 410 core
+#extension GL_ARB_shader_stencil_export : enable
 
 out vec4 FragColor;
 
+// Tested against the silhouette of the instance's own fill, where the extension exists (see Scene::Render)
+flat in uint stencilRef;
+
 void main()
 {
+#ifdef GL_ARB_shader_stencil_export
+	gl_FragStencilRefARB = int(stencilRef);
+#endif
 	FragColor = vec4(0.0f, 0.0f, 0.0f, 1.0f);
 }
\ No newline at end of file
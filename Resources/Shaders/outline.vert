@@ -1,13 +1,53 @@
-#version 410 core
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : enable
 
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 normal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Same per draw data as phong_light_tex.vert
+struct DrawObject
+{
+	mat4 model;
+	vec4 decodeOffset;
+	vec4 decodeScale;
+	vec4 material;
+	uvec4 flags;
+};
+
+layout (std430, binding = 0) readonly buffer DrawObjects
+{
+	DrawObject objects[];
+};
+
+layout (std430, binding = 1) readonly buffer CommandObjects
+{
+	uint commandObjects[];
+};
+
+#ifdef GL_ARB_shader_draw_parameters
+uniform int drawBase;
+uint drawObject() { return commandObjects[drawBase + gl_DrawIDARB] + uint(gl_InstanceID); }
+#else
+layout (location = 5) in uint drawIndex;
+uint drawObject() { return drawIndex; }
+#endif
+
+// Per frame camera, shared by every program (see CameraBlock in uniform_blocks.h)
+layout (std140, binding = 0) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+uniform float outlineScale;
+
+flat out uint stencilRef;
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(pos, 1.0f);
+	DrawObject object = objects[drawObject()];
+
+	vec3 position = object.decodeOffset.xyz + pos * object.decodeScale.xyz;
+	stencilRef = object.flags.y;
+	gl_Position = projection * view * object.model * vec4(position * outlineScale, 1.0f);
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 normal;
 
+// Per mesh constants from Mesh::DrawBasic, undo the vertex quantization (see vertex_format.h)
+layout (location = 3) in vec4 decodeOffset; // xyz position offset, w = 1 for octahedral normals
+layout (location = 4) in vec3 decodeScale;
+
 out vec3 fragPos;
 out vec3 fragNormal;
 
@@ -10,9 +14,25 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+vec3 decodePosition()
+{
+	return decodeOffset.xyz + pos * decodeScale;
+}
+
+vec3 decodeNormal()
+{
+	if (decodeOffset.w < 0.5)
+		return normal;
+
+	vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
 void main()
 {
-	fragPos = vec3(model * vec4(pos, 1.0));
-	fragNormal = mat3(transpose(inverse(model))) * normal;
+	fragPos = vec3(model * vec4(decodePosition(), 1.0));
+	fragNormal = mat3(transpose(inverse(model))) * decodeNormal();
 	gl_Position = projection * view * vec4(fragPos, 1.0);
 }
\ No newline at end of file
@@ -1,4 +1,7 @@
-#version 410 core
+#version 450 core
+#extension GL_ARB_shader_stencil_export : enable
+
+#include "toon_lighting.glsl"
 
 out vec4 FragColor;
 
@@ -8,28 +11,6 @@ struct Material
 	float shininess;
 };
 
-struct DirectionLight
-{
-	vec3 direction;
-
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-};
-
-struct PointLight
-{
-	vec3 position;
-	
-	vec3 ambient;
-	vec3 diffuse;
-	vec3 specular;
-
-	float constant;
-	float linear;
-	float quadratic;
-};
-
 struct PhongVar
 {
 	vec3 ambient;
@@ -39,82 +20,32 @@ struct PhongVar
 in vec3 fragPos;
 in vec3 fragNormal;
 in vec2 fragUV;
+flat in vec4 fragMaterial;
+flat in uint fragStencilRef; // marks the silhouette with the instance's own ref, where the extension exists
 
-uniform Material material;
+Material material; // filled from the per draw data at the start of main
 
 uniform sampler2D diffuse0;
 uniform sampler2D specular0;
 
-uniform DirectionLight directionLight;
-uniform PointLight pointLight;
-uniform vec3 viewPos;
-uniform bool toonMode;
-
-float toonQuantize5(float value)
-{
-	if (value < 0.1) return (0.0);
-	else if (value < 0.2) return (0.2);
-	else if (value < 0.4) return (0.4);
-	else if (value < 0.6) return (0.6);
-	else if (value < 0.8) return (0.8);
-	else return (1.0);
-}
-
-float toonQuantize4(float value)
+// Set by LightManager::Update when the lights change (see LightsBlock in light_manager.h)
+layout (std140, binding = 1) uniform Lights
 {
-	if (value < 0.1) return (0.0);
-	else if (value < 0.4) return (0.4);
-	else if (value < 0.8) return (0.6);
-	else return (1.0);
-}
-
-vec3 phongPointLight(PointLight pl, vec3 norm, vec3 viewDir, vec3 diffTex, vec3 specTex)
-{
-	// Attenuation
-	float dist = length(pointLight.position - fragPos);
-	float attn = 1.0 / (pointLight.constant + (pointLight.linear * dist) + (pointLight.quadratic * (dist * dist)));
-
-	// Ambient
-	vec3 ambient = pl.ambient * material.ambient * attn;
-
-	// Diffuse
-	vec3 lightDir = normalize(pl.position - fragPos);
-
-	float diff = max(dot(norm, lightDir), 0.0);
-	vec3 diffuse = pl.diffuse * (toonQuantize5(diff) * diffTex) * attn;
-
-	// Specular
-	vec3 reflectDir = reflect(-lightDir, norm);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	vec3 specular = pl.specular * (toonQuantize4(spec) * specTex.xyz) * attn;
-
-	return (ambient + diffuse + specular);
-}
+	DirectionLight directionLight;
+	PointLight pointLight;
+};
 
-vec3 phongDirectionLight(DirectionLight dl, vec3 norm, vec3 viewDir, vec3 diffTex, vec3 specTex)
+// Per frame camera, shared by every program (see CameraBlock in uniform_blocks.h)
+layout (std140, binding = 0) uniform Camera
 {
-	// Ambient
-	vec3 ambient = dl.ambient * material.ambient;
-	
-	// Diffuse
-	vec3 lightDir = normalize(-dl.direction);
-	float diff = max(dot(norm, lightDir), 0.0);
-	vec3 diffuse = dl.diffuse * (toonQuantize5(diff) * diffTex);
-
-	// Specular
-	vec3 reflectDir = reflect(-lightDir, norm);
-	float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-	vec3 specular = dl.specular * (toonQuantize4(spec) * specTex);
-
-	return (ambient + diffuse + specular);
-}
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
 
 void main()
 {
-	int toonLevels = 5;
-
-	vec3 norm = normalize(fragNormal);
-	vec3 viewDir = normalize(viewPos - fragPos);
+	material = Material(fragMaterial.rgb, fragMaterial.a);
 
 	vec3 diffTex = texture(diffuse0, fragUV).rgb;
 	vec3 specTex = texture(specular0, fragUV).rgb;
@@ -122,14 +53,17 @@ void main()
 	diffTex = mix(vec3(0.2), mix(vec3(0.5), mix(vec3(0.8), vec3(1.0), smoothstep(0.75, 0.85, diffTex)), smoothstep(0.55, 0.65, diffTex)), smoothstep(0.35, 0.45, diffTex));
 	specTex = mix(vec3(0.2), mix(vec3(0.5), mix(vec3(0.8), vec3(1.0), smoothstep(0.75, 0.85, specTex)), smoothstep(0.55, 0.65, specTex)), smoothstep(0.35, 0.45, specTex));
 
-	vec3 result = phongDirectionLight(directionLight, norm, viewDir, diffTex, specTex) + phongPointLight(pointLight, norm, viewDir, diffTex, specTex);
-
-	// Edge Detection
-	if (toonMode) {
-		float edge = step(0.2, dot(norm, viewDir));
-		FragColor = vec4(result * edge, 1.0f);
-	} else {
-		FragColor = vec4(result, 1.0);
-	}
+	ToonSurface surface;
+	surface.position = fragPos;
+	surface.normal = normalize(fragNormal);
+	surface.viewDir = normalize(viewPos - fragPos);
+	surface.ambient = material.ambient;
+	surface.diffuse = diffTex;
+	surface.specular = specTex;
+	surface.shininess = material.shininess;
+
+#ifdef GL_ARB_shader_stencil_export
+	gl_FragStencilRefARB = int(fragStencilRef);
+#endif
+	FragColor = vec4(toonEdge(toonLighting(directionLight, pointLight, surface), surface), 1.0);
 }
-
@@ -1,22 +1,77 @@
-#version 410 core
+#version 450 core
+#extension GL_ARB_shader_draw_parameters : enable
 
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 uv;
 
+// Per draw data from Scene::Render, one entry per mesh and instance (instanced commands read consecutive entries)
+struct DrawObject
+{
+	mat4 model;
+	vec4 decodeOffset; // undo the vertex quantization (see vertex_format.h), xyz position offset, w = 1 for octahedral normals
+	vec4 decodeScale;
+	vec4 material;     // ambient, shininess
+	uvec4 flags;       // x : toonMode, picks the program variant on the CPU side (see Scene), y : stencil ref of the instance
+};
+
+layout (std430, binding = 0) readonly buffer DrawObjects
+{
+	DrawObject objects[];
+};
+
+layout (std430, binding = 1) readonly buffer CommandObjects
+{
+	uint commandObjects[];
+};
+
+#ifdef GL_ARB_shader_draw_parameters
+uniform int drawBase; // first command of the glMultiDrawElementsIndirect call
+uint drawObject() { return commandObjects[drawBase + gl_DrawIDARB] + uint(gl_InstanceID); }
+#else
+layout (location = 5) in uint drawIndex; // the command's baseInstance + gl_InstanceID, see GeometryArena::ReserveDrawIndices
+uint drawObject() { return drawIndex; }
+#endif
+
 out vec3 fragPos;
 out vec3 fragNormal;
 out vec2 fragUV;
+flat out vec4 fragMaterial;
+flat out uint fragStencilRef;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per frame camera, shared by every program (see CameraBlock in uniform_blocks.h)
+layout (std140, binding = 0) uniform Camera
+{
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+vec3 decodePosition(DrawObject object)
+{
+	return object.decodeOffset.xyz + pos * object.decodeScale.xyz;
+}
+
+vec3 decodeNormal(DrawObject object)
+{
+	if (object.decodeOffset.w < 0.5)
+		return normal;
+
+	vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
 
 void main()
 {
-	fragPos = vec3(model * vec4(pos, 1.0));
-	fragNormal = mat3(transpose(inverse(model))) * normal;
+	DrawObject object = objects[drawObject()];
+
+	fragPos = vec3(object.model * vec4(decodePosition(object), 1.0));
+	fragNormal = mat3(transpose(inverse(object.model))) * decodeNormal(object);
 	fragUV = uv;
+	fragMaterial = object.material;
+	fragStencilRef = object.flags.y;
 
 	gl_Position = projection * view * vec4(fragPos, 1.0);
 }
\ No newline at end of file
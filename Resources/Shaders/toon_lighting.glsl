@@ -0,0 +1,112 @@
+// Light structs and toon shaded Phong terms shared by phong_light.frag and phong_light_tex.frag
+// Permutation switches (ShaderDefines), defaulted below :
+//   TOON_BANDS   : steps of the quantized diffuse term
+//   TOON_EDGES   : 1 darkens silhouettes (see toonEdge), 0 leaves them out of the program
+//   POINT_LIGHTS : 0 or 1, the point light of the Lights block
+
+#ifndef TOON_BANDS
+#define TOON_BANDS 5
+#endif
+
+#ifndef TOON_EDGES
+#define TOON_EDGES 1
+#endif
+
+#ifndef POINT_LIGHTS
+#define POINT_LIGHTS 1
+#endif
+
+struct DirectionLight
+{
+	vec3 direction;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+struct PointLight
+{
+	vec3 position;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+
+	float constant;
+	float linear;
+	float quadratic;
+};
+
+// Surface terms of one fragment, filled by the including shader
+struct ToonSurface
+{
+	vec3 position;
+	vec3 normal;
+	vec3 viewDir;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+	float shininess;
+};
+
+// TOON_BANDS even steps, anything under 0.1 is unlit
+float toonQuantize(float value)
+{
+	if (value < 0.1) return (0.0);
+	return (min(ceil(value * float(TOON_BANDS)) / float(TOON_BANDS), 1.0));
+}
+
+float toonQuantizeSpecular(float value)
+{
+	if (value < 0.1) return (0.0);
+	else if (value < 0.4) return (0.4);
+	else if (value < 0.8) return (0.6);
+	else return (1.0);
+}
+
+vec3 toonPhong(vec3 lightDir, vec3 ambient, vec3 diffuse, vec3 specular, ToonSurface surface)
+{
+	// Diffuse
+	float diff = max(dot(surface.normal, lightDir), 0.0);
+
+	// Specular
+	vec3 reflectDir = reflect(-lightDir, surface.normal);
+	float spec = pow(max(dot(surface.viewDir, reflectDir), 0.0), surface.shininess);
+
+	return (ambient * surface.ambient + diffuse * (toonQuantize(diff) * surface.diffuse) + specular * (toonQuantizeSpecular(spec) * surface.specular));
+}
+
+vec3 phongDirectionLight(DirectionLight dl, ToonSurface surface)
+{
+	return (toonPhong(normalize(-dl.direction), dl.ambient, dl.diffuse, dl.specular, surface));
+}
+
+vec3 phongPointLight(PointLight pl, ToonSurface surface)
+{
+	// Attenuation
+	float dist = length(pl.position - surface.position);
+	float attn = 1.0 / (pl.constant + (pl.linear * dist) + (pl.quadratic * (dist * dist)));
+
+	return (toonPhong(normalize(pl.position - surface.position), pl.ambient, pl.diffuse, pl.specular, surface) * attn);
+}
+
+vec3 toonLighting(DirectionLight dl, PointLight pl, ToonSurface surface)
+{
+	vec3 result = phongDirectionLight(dl, surface);
+#if POINT_LIGHTS > 0
+	result += phongPointLight(pl, surface);
+#endif
+	return (result);
+}
+
+// Edge Detection
+vec3 toonEdge(vec3 color, ToonSurface surface)
+{
+#if TOON_EDGES
+	return (color * step(0.2, dot(surface.normal, surface.viewDir)));
+#else
+	return (color);
+#endif
+}
@@ -0,0 +1,58 @@
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef TOONSHADE_COUNT_ALLOCATIONS
+
+// Per thread : loader and pool threads allocate freely while the render thread is measured
+static thread_local std::size_t allocationCount = 0;
+
+static void* countedAlloc(std::size_t size)
+{
+	allocationCount++;
+	return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(std::size_t size)
+{
+	void* ptr = countedAlloc(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new[](std::size_t size)
+{
+	void* ptr = countedAlloc(size);
+	if (!ptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAlloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { std::free(ptr); }
+
+bool AllocationCounter::Enabled() { return true; }
+void AllocationCounter::Reset() { allocationCount = 0; }
+std::size_t AllocationCounter::Count() { return allocationCount; }
+
+#else
+
+bool AllocationCounter::Enabled() { return false; }
+void AllocationCounter::Reset() {}
+std::size_t AllocationCounter::Count() { return 0; }
+
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+// Counts heap allocations made through the global operator new, on the calling thread only.
+// Counting is only compiled in when TOONSHADE_COUNT_ALLOCATIONS is defined (Debug configurations),
+// otherwise Count() always returns 0.
+class AllocationCounter
+{
+public:
+	static bool Enabled();
+
+	static void Reset();
+	static std::size_t Count();
+};
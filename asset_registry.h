@@ -0,0 +1,178 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include "geometry_arena.h"
+#include "gl_state.h"
+#include "vertex_format.h"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// GPU geometry backing one mesh, shared by every Mesh with the same content
+struct MeshBuffers
+{
+	GeometryArena::BlockId geometry;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	VertexFormat format;
+	VertexDecode decode;
+	GLenum indexType;
+	std::size_t vertexBytes;
+	std::size_t indexBytes;
+};
+
+// Process-wide, content-addressed store of GPU textures and meshes
+// Identical content (same hash) is uploaded once and reference counted; the last Release deletes the texture or frees the arena block.
+// Lookups are safe from any thread, Register / Release must run on the GL thread.
+class AssetRegistry
+{
+public:
+	struct Stats
+	{
+		unsigned int textures;
+		unsigned int meshes;
+		unsigned int textureReuses;
+		unsigned int meshReuses;
+	};
+
+	static AssetRegistry& Get()
+	{
+		static AssetRegistry registry;
+		return registry;
+	}
+
+	// FNV-1a, chained through seed. 0 is reserved for "not content addressed".
+	static std::uint64_t Hash(const void* data, std::size_t size, std::uint64_t seed = 14695981039346656037ULL)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		std::uint64_t hash = seed;
+		for (std::size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash == 0 ? 1 : hash;
+	}
+
+	bool HasTexture(std::uint64_t hash) const
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+		return hash != 0 && textures.count(hash) != 0;
+	}
+
+	// Returns 0 when the texture isn't resident, otherwise takes a reference (and reports the size it was registered with)
+	GLuint AcquireTexture(std::uint64_t hash, std::size_t* bytes = nullptr)
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+
+		std::unordered_map<std::uint64_t, TextureEntry>::iterator it = textures.find(hash);
+		if (hash == 0 || it == textures.end())
+			return 0;
+
+		it->second.references++;
+		stats.textureReuses++;
+		if (bytes)
+			*bytes = it->second.bytes;
+		return it->second.ID;
+	}
+
+	void RegisterTexture(std::uint64_t hash, GLuint textureID, std::size_t bytes)
+	{
+		if (hash == 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(registryMutex);
+		TextureEntry entry = { textureID, bytes, 1 };
+		textures[hash] = entry;
+	}
+
+	void ReleaseTexture(std::uint64_t hash, GLuint textureID)
+	{
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+
+			std::unordered_map<std::uint64_t, TextureEntry>::iterator it = textures.find(hash);
+			if (hash != 0 && it != textures.end())
+			{
+				if (--it->second.references > 0)
+					return;
+				textures.erase(it);
+			}
+		}
+		glDeleteTextures(1, &textureID);
+		GLState::Get().TextureDeleted(textureID);
+	}
+
+	bool AcquireMesh(std::uint64_t hash, MeshBuffers& buffers)
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+
+		std::unordered_map<std::uint64_t, MeshEntry>::iterator it = meshes.find(hash);
+		if (hash == 0 || it == meshes.end())
+			return false;
+
+		it->second.references++;
+		stats.meshReuses++;
+		buffers = it->second.buffers;
+		return true;
+	}
+
+	void RegisterMesh(std::uint64_t hash, const MeshBuffers& buffers)
+	{
+		if (hash == 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(registryMutex);
+		MeshEntry entry = { buffers, 1 };
+		meshes[hash] = entry;
+	}
+
+	void ReleaseMesh(std::uint64_t hash, const MeshBuffers& buffers)
+	{
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+
+			std::unordered_map<std::uint64_t, MeshEntry>::iterator it = meshes.find(hash);
+			if (hash != 0 && it != meshes.end())
+			{
+				if (--it->second.references > 0)
+					return;
+				meshes.erase(it);
+			}
+		}
+		GeometryArena::Get().Free(buffers.geometry);
+	}
+
+	Stats GetStats() const
+	{
+		std::lock_guard<std::mutex> lock(registryMutex);
+
+		Stats current = stats;
+		current.textures = static_cast<unsigned int>(textures.size());
+		current.meshes = static_cast<unsigned int>(meshes.size());
+		return current;
+	}
+private:
+	struct TextureEntry
+	{
+		GLuint ID;
+		std::size_t bytes;
+		unsigned int references;
+	};
+
+	struct MeshEntry
+	{
+		MeshBuffers buffers;
+		unsigned int references;
+	};
+
+	std::unordered_map<std::uint64_t, TextureEntry> textures;
+	std::unordered_map<std::uint64_t, MeshEntry> meshes;
+	Stats stats;
+
+	mutable std::mutex registryMutex;
+
+	AssetRegistry() : stats() {}
+};
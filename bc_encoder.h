@@ -0,0 +1,414 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "thread_pool.h"
+
+// CPU block compressor for BC1 (DXT1, opaque RGB) and BC3 (DXT5, RGBA)
+// Endpoints come from the principal axis of each 4x4 block and are refined once by least squares.
+// Pure CPU, so caches can be baked on machines without a GPU.
+class BCEncoder
+{
+public:
+	enum Format : std::uint32_t
+	{
+		BC1 = 1,
+		BC3 = 3
+	};
+
+	static unsigned int BlockBytes(Format format)
+	{
+		return format == BC1 ? 8 : 16;
+	}
+
+	static std::size_t LevelBytes(Format format, unsigned int width, unsigned int height)
+	{
+		return static_cast<std::size_t>((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+	}
+
+	// rgba is tightly packed RGBA8, out must hold LevelBytes(). Block rows are spread over the pool when one is given,
+	// never pass a pool from inside one of its own tasks.
+	static void Encode(const unsigned char* rgba, unsigned int width, unsigned int height, Format format, unsigned char* out, ThreadPool* pool = nullptr)
+	{
+		unsigned int blockRows = (height + 3) / 4;
+		if (!pool || blockRows < 2)
+		{
+			encodeRows(rgba, width, height, format, out, 0, blockRows);
+			return;
+		}
+
+		unsigned int chunks = std::min(blockRows, pool->Size() + 1);
+		unsigned int rowsPerChunk = (blockRows + chunks - 1) / chunks;
+
+		std::vector<std::future<void>> pending;
+		for (unsigned int first = rowsPerChunk; first < blockRows; first += rowsPerChunk)
+		{
+			unsigned int last = std::min(blockRows, first + rowsPerChunk);
+			pending.push_back(pool->Submit([=]() { encodeRows(rgba, width, height, format, out, first, last); }));
+		}
+
+		encodeRows(rgba, width, height, format, out, 0, std::min(blockRows, rowsPerChunk));
+
+		for (unsigned int i = 0; i < pending.size(); i++)
+			pending[i].get();
+	}
+
+	// block is 16 RGBA8 texels in row order
+	static void EncodeBlock(const unsigned char block[64], Format format, unsigned char* out)
+	{
+		if (format == BC3)
+		{
+			encodeAlpha(block, out);
+			encodeColor(block, out + 8);
+		}
+		else
+		{
+			encodeColor(block, out);
+		}
+	}
+
+	// Inverse of EncodeBlock, with the same palette arithmetic as the encoder. For checking it on the CPU (see main.cpp).
+	static void DecodeBlock(const unsigned char* in, Format format, unsigned char block[64])
+	{
+		const unsigned char* color = format == BC3 ? in + 8 : in;
+		std::uint16_t c0 = static_cast<std::uint16_t>(color[0] | (color[1] << 8));
+		std::uint16_t c1 = static_cast<std::uint16_t>(color[2] | (color[3] << 8));
+		std::uint32_t indices = static_cast<std::uint32_t>(color[4]) | (static_cast<std::uint32_t>(color[5]) << 8) | (static_cast<std::uint32_t>(color[6]) << 16) | (static_cast<std::uint32_t>(color[7]) << 24);
+
+		int palette[4][4];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		bool fourColor = c0 > c1 || format == BC3;
+		for (int c = 0; c < 3; c++)
+		{
+			if (fourColor)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			else
+			{
+				// BC1 3-color mode, index 3 is transparent black. The encoder never writes it.
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+		palette[0][3] = palette[1][3] = palette[2][3] = 255;
+		palette[3][3] = fourColor ? 255 : 0;
+
+		for (int i = 0; i < 16; i++)
+		{
+			const int* texel = palette[(indices >> (i * 2)) & 3];
+			for (int c = 0; c < 4; c++)
+				block[i * 4 + c] = static_cast<unsigned char>(texel[c]);
+		}
+
+		if (format != BC3)
+			return;
+
+		int alphas[8];
+		alphas[0] = in[0];
+		alphas[1] = in[1];
+		for (int p = 1; p < 7; p++)
+			alphas[p + 1] = ((7 - p) * alphas[0] + p * alphas[1]) / 7;
+		if (alphas[0] <= alphas[1])
+		{
+			// 6-value mode, also never written by the encoder
+			for (int p = 1; p < 5; p++)
+				alphas[p + 1] = ((5 - p) * alphas[0] + p * alphas[1]) / 5;
+			alphas[6] = 0;
+			alphas[7] = 255;
+		}
+
+		std::uint64_t bits = 0;
+		for (int i = 0; i < 6; i++)
+			bits |= static_cast<std::uint64_t>(in[2 + i]) << (i * 8);
+		for (int i = 0; i < 16; i++)
+			block[i * 4 + 3] = static_cast<unsigned char>(alphas[(bits >> (i * 3)) & 7]);
+	}
+private:
+	static void encodeRows(const unsigned char* rgba, unsigned int width, unsigned int height, Format format, unsigned char* out, unsigned int firstRow, unsigned int lastRow)
+	{
+		unsigned int blocksX = (width + 3) / 4;
+		unsigned char block[64];
+
+		for (unsigned int by = firstRow; by < lastRow; by++)
+		{
+			for (unsigned int bx = 0; bx < blocksX; bx++)
+			{
+				fetchBlock(rgba, width, height, bx, by, block);
+				EncodeBlock(block, format, out + (static_cast<std::size_t>(by) * blocksX + bx) * BlockBytes(format));
+			}
+		}
+	}
+
+	// Edge texels are repeated for blocks hanging over the image border
+	static void fetchBlock(const unsigned char* rgba, unsigned int width, unsigned int height, unsigned int bx, unsigned int by, unsigned char block[64])
+	{
+		for (unsigned int y = 0; y < 4; y++)
+		{
+			unsigned int sy = std::min(by * 4 + y, height - 1);
+			for (unsigned int x = 0; x < 4; x++)
+			{
+				unsigned int sx = std::min(bx * 4 + x, width - 1);
+				const unsigned char* texel = rgba + (static_cast<std::size_t>(sy) * width + sx) * 4;
+				unsigned char* dst = block + (y * 4 + x) * 4;
+				dst[0] = texel[0];
+				dst[1] = texel[1];
+				dst[2] = texel[2];
+				dst[3] = texel[3];
+			}
+		}
+	}
+
+	static std::uint16_t to565(const float color[3])
+	{
+		int r = static_cast<int>(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		int g = static_cast<int>(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+		int b = static_cast<int>(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		return static_cast<std::uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	static void from565(std::uint16_t packed, int color[3])
+	{
+		int r = (packed >> 11) & 31;
+		int g = (packed >> 5) & 63;
+		int b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// Picks the closest of the four palette entries per texel, returns the packed 2-bit indices
+	static std::uint32_t colorIndices(const unsigned char block[64], std::uint16_t c0, std::uint16_t c1)
+	{
+		int palette[4][3];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		std::uint32_t indices = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			const unsigned char* texel = block + i * 4;
+
+			int best = 0;
+			int bestError = 0x7FFFFFFF;
+			for (int p = 0; p < 4; p++)
+			{
+				int dr = texel[0] - palette[p][0];
+				int dg = texel[1] - palette[p][1];
+				int db = texel[2] - palette[p][2];
+				int error = dr * dr + dg * dg + db * db;
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= static_cast<std::uint32_t>(best) << (i * 2);
+		}
+		return indices;
+	}
+
+	// Always 4-color mode (c0 > c1), which is also how BC3 decodes its color half
+	static void encodeColor(const unsigned char block[64], unsigned char* out)
+	{
+		float mean[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 3; c++)
+				mean[c] += block[i * 4 + c];
+		for (int c = 0; c < 3; c++)
+			mean[c] /= 16.0f;
+
+		float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			float r = block[i * 4 + 0] - mean[0];
+			float g = block[i * 4 + 1] - mean[1];
+			float b = block[i * 4 + 2] - mean[2];
+			cov[0] += r * r;
+			cov[1] += r * g;
+			cov[2] += r * b;
+			cov[3] += g * g;
+			cov[4] += g * b;
+			cov[5] += b * b;
+		}
+
+		// Principal axis by power iteration
+		float axis[3] = { 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+			float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+			float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+			float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+			if (length < 1e-6f)
+				break;
+			axis[0] = x / length;
+			axis[1] = y / length;
+			axis[2] = z / length;
+		}
+
+		float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+		for (int c = 0; c < 3; c++)
+			axis[c] /= axisLength;
+
+		float tMin = 0.0f, tMax = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = (block[i * 4 + 0] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+
+		float end0[3], end1[3];
+		for (int c = 0; c < 3; c++)
+		{
+			end0[c] = mean[c] + axis[c] * tMax;
+			end1[c] = mean[c] + axis[c] * tMin;
+		}
+
+		std::uint16_t c0 = to565(end0);
+		std::uint16_t c1 = to565(end1);
+		std::uint32_t indices = orderedIndices(block, c0, c1);
+
+		// Least squares refit of the endpoints against the chosen indices
+		if (c0 != c1)
+		{
+			static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+			float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+			float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 16; i++)
+			{
+				float alpha = weights[(indices >> (i * 2)) & 3];
+				float beta = 1.0f - alpha;
+				aa += alpha * alpha;
+				bb += beta * beta;
+				ab += alpha * beta;
+				for (int c = 0; c < 3; c++)
+				{
+					ax[c] += alpha * block[i * 4 + c];
+					bx[c] += beta * block[i * 4 + c];
+				}
+			}
+
+			float det = aa * bb - ab * ab;
+			if (std::fabs(det) > 1e-6f)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					end0[c] = (ax[c] * bb - bx[c] * ab) / det;
+					end1[c] = (bx[c] * aa - ax[c] * ab) / det;
+				}
+
+				std::uint16_t r0 = to565(end0);
+				std::uint16_t r1 = to565(end1);
+				std::uint32_t refined = orderedIndices(block, r0, r1);
+				if (blockError(block, r0, r1, refined) < blockError(block, c0, c1, indices))
+				{
+					c0 = r0;
+					c1 = r1;
+					indices = refined;
+				}
+			}
+		}
+
+		out[0] = static_cast<unsigned char>(c0 & 0xFF);
+		out[1] = static_cast<unsigned char>(c0 >> 8);
+		out[2] = static_cast<unsigned char>(c1 & 0xFF);
+		out[3] = static_cast<unsigned char>(c1 >> 8);
+		out[4] = static_cast<unsigned char>(indices & 0xFF);
+		out[5] = static_cast<unsigned char>((indices >> 8) & 0xFF);
+		out[6] = static_cast<unsigned char>((indices >> 16) & 0xFF);
+		out[7] = static_cast<unsigned char>(indices >> 24);
+	}
+
+	// Swaps the endpoints into 4-color order (c0 > c1) and returns matching indices
+	static std::uint32_t orderedIndices(const unsigned char block[64], std::uint16_t& c0, std::uint16_t& c1)
+	{
+		if (c0 < c1)
+			std::swap(c0, c1);
+		if (c0 == c1)
+			return 0;
+		return colorIndices(block, c0, c1);
+	}
+
+	static int blockError(const unsigned char block[64], std::uint16_t c0, std::uint16_t c1, std::uint32_t indices)
+	{
+		int palette[4][3];
+		from565(c0, palette[0]);
+		from565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		int error = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			const int* color = palette[(indices >> (i * 2)) & 3];
+			for (int c = 0; c < 3; c++)
+			{
+				int d = block[i * 4 + c] - color[c];
+				error += d * d;
+			}
+		}
+		return error;
+	}
+
+	// 8-value interpolated alpha block (a0 > a1)
+	static void encodeAlpha(const unsigned char block[64], unsigned char* out)
+	{
+		int a0 = 0, a1 = 255;
+		for (int i = 0; i < 16; i++)
+		{
+			a0 = std::max(a0, static_cast<int>(block[i * 4 + 3]));
+			a1 = std::min(a1, static_cast<int>(block[i * 4 + 3]));
+		}
+
+		out[0] = static_cast<unsigned char>(a0);
+		out[1] = static_cast<unsigned char>(a1);
+
+		std::uint64_t bits = 0;
+		if (a0 != a1)
+		{
+			int palette[8];
+			palette[0] = a0;
+			palette[1] = a1;
+			for (int p = 1; p < 7; p++)
+				palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+
+			for (int i = 0; i < 16; i++)
+			{
+				int alpha = block[i * 4 + 3];
+
+				int best = 0;
+				int bestError = 256;
+				for (int p = 0; p < 8; p++)
+				{
+					int error = std::abs(alpha - palette[p]);
+					if (error < bestError)
+					{
+						bestError = error;
+						best = p;
+					}
+				}
+				bits |= static_cast<std::uint64_t>(best) << (i * 3);
+			}
+		}
+
+		for (int i = 0; i < 6; i++)
+			out[2 + i] = static_cast<unsigned char>((bits >> (i * 8)) & 0xFF);
+	}
+};
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <stb/stb_image.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "asset_registry.h"
+#include "bc_encoder.h"
+#include "mapped_file.h"
+#include "texture_mips.h"
+
+// S3TC enums, glad is generated without the extension
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// Block compressed texture with its full mip chain, cached next to the source as "<content hash>.bctex"
+// Layout (KTX2-like) : Header | Level index (width, height, offset, size) | 16-byte aligned level payloads
+// A cached texture is uploaded straight out of the mapping, nothing is decoded at load time.
+class CompressedTexture
+{
+public:
+	static const std::uint32_t VERSION = 2;
+
+	struct Level
+	{
+		std::uint32_t width;
+		std::uint32_t height;
+		std::uint64_t offset;
+		std::uint64_t size;
+	};
+
+	BCEncoder::Format format;
+	std::uint32_t width, height;
+	bool srgb;  // mips filtered in linear space, sampled through an sRGB format
+	std::vector<Level> levels;
+
+	CompressedTexture() : format(BCEncoder::BC1), width(0), height(0), srgb(false) {}
+
+	CompressedTexture(const CompressedTexture&) = delete;
+	CompressedTexture& operator=(const CompressedTexture&) = delete;
+
+	// Switched on by the application once the context reports S3TC support, or by the offline baker
+	static bool Enabled()
+	{
+		return enabledFlag().load();
+	}
+
+	static void SetEnabled(bool enabled)
+	{
+		enabledFlag().store(enabled);
+	}
+
+	// GL thread only
+	static bool Supported()
+	{
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount; i++)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if (name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+				return true;
+		}
+		return false;
+	}
+
+	static std::string CachePath(const std::string& directory, std::uint64_t contentHash)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(contentHash));
+		return directory + '/' + name + ".bctex";
+	}
+
+	GLenum InternalFormat() const
+	{
+		if (format == BCEncoder::BC3)
+			return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+
+	const unsigned char* LevelData(unsigned int level) const
+	{
+		return base() + levels[level].offset;
+	}
+
+	std::size_t TotalBytes() const
+	{
+		std::size_t total = 0;
+		for (unsigned int i = 0; i < levels.size(); i++)
+			total += static_cast<std::size_t>(levels[i].size);
+		return total;
+	}
+
+	// key is the content hash of the encoded source image (chained with the sRGB flag, see Model::decodeTexture)
+	bool Open(const std::string& path, std::uint64_t key)
+	{
+		levels.clear();
+		if (!file.Open(path))
+			return false;
+
+		if (file.Size() < sizeof(Header))
+			return fail();
+
+		Header header;
+		std::memcpy(&header, file.Data(), sizeof(Header));
+		if (std::memcmp(header.magic, "TSBC", 4) != 0 || header.version != VERSION || header.key != key || header.levelCount == 0)
+			return fail();
+		if (header.format != BCEncoder::BC1 && header.format != BCEncoder::BC3)
+			return fail();
+
+		std::size_t indexEnd = sizeof(Header) + static_cast<std::size_t>(header.levelCount) * sizeof(Level);
+		if (indexEnd > file.Size())
+			return fail();
+
+		format = static_cast<BCEncoder::Format>(header.format);
+		width = header.width;
+		height = header.height;
+		srgb = (header.flags & FLAG_SRGB) != 0;
+		levels.resize(header.levelCount);
+		std::memcpy(levels.data(), file.Data() + sizeof(Header), levels.size() * sizeof(Level));
+
+		for (unsigned int i = 0; i < levels.size(); i++)
+		{
+			if (levels[i].size != BCEncoder::LevelBytes(format, levels[i].width, levels[i].height) || levels[i].offset + levels[i].size > file.Size())
+				return fail();
+		}
+		return true;
+	}
+
+	// Builds the mips and encodes every level, BC3 when the image has alpha, BC1 otherwise
+	// pool spreads the block rows over workers, leave it null when already running on one
+	static std::unique_ptr<CompressedTexture> Compress(const unsigned char* pixels, int width, int height, int components, bool srgb, ThreadPool* pool = nullptr)
+	{
+		std::unique_ptr<CompressedTexture> texture(new CompressedTexture());
+		texture->width = static_cast<std::uint32_t>(width);
+		texture->height = static_cast<std::uint32_t>(height);
+		texture->format = components == 2 || components == 4 ? BCEncoder::BC3 : BCEncoder::BC1;
+		texture->srgb = srgb;
+
+		std::vector<unsigned char> rgba = MipChain::ExpandRGBA(pixels, width, height, components);
+		std::vector<MipChain::Level> mips = MipChain::Build(rgba.data(), width, height, 4, srgb);
+
+		std::uint64_t cursor = 0;
+		texture->levels.resize(mips.size());
+		for (unsigned int i = 0; i < mips.size(); i++)
+		{
+			Level& level = texture->levels[i];
+			level.width = mips[i].width;
+			level.height = mips[i].height;
+			level.offset = cursor;
+			level.size = BCEncoder::LevelBytes(texture->format, level.width, level.height);
+			cursor = align(cursor + level.size);
+		}
+
+		texture->owned.resize(static_cast<std::size_t>(cursor));
+		for (unsigned int i = 0; i < mips.size(); i++)
+			BCEncoder::Encode(mips[i].texels.data(), mips[i].width, mips[i].height, texture->format, &texture->owned[static_cast<std::size_t>(texture->levels[i].offset)], pool);
+
+		return texture;
+	}
+
+	bool Write(const std::string& path, std::uint64_t key) const
+	{
+		Header header;
+		std::memcpy(header.magic, "TSBC", 4);
+		header.version = VERSION;
+		header.format = format;
+		header.width = width;
+		header.height = height;
+		header.flags = srgb ? FLAG_SRGB : 0;
+		header.levelCount = static_cast<std::uint32_t>(levels.size());
+		header.reserved = 0;
+		header.key = key;
+
+		std::uint64_t dataStart = align(sizeof(Header) + levels.size() * sizeof(Level));
+		std::vector<Level> index = levels;
+		for (unsigned int i = 0; i < index.size(); i++)
+			index[i].offset = dataStart + (levels[i].offset - levels[0].offset);
+
+		// Moved over the target once complete, a reader never maps a half written cache
+		std::string tempPath = path + ".tmp";
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		out.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(Level));
+		for (unsigned int i = 0; i < levels.size(); i++)
+		{
+			while (static_cast<std::uint64_t>(out.tellp()) < index[i].offset)
+				out.put(0);
+			out.write(reinterpret_cast<const char*>(LevelData(i)), static_cast<std::streamsize>(levels[i].size));
+		}
+
+		out.close();
+		if (!out || !MoveFileReplacing(tempPath, path))
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// Cache key and registry hash of an image, the same bytes sampled as sRGB are a different texture
+	static std::uint64_t ContentKey(const unsigned char* encoded, std::size_t size, bool srgb)
+	{
+		std::uint64_t key = AssetRegistry::Hash(encoded, size);
+		return srgb ? AssetRegistry::Hash("srgb", 4, key) : key;
+	}
+
+	// Offline path : decode an image file, compress it and write the cache beside it
+	static bool Bake(const std::string& imagePath, bool srgb, ThreadPool* pool)
+	{
+		MappedFile source;
+		if (!source.Open(imagePath))
+		{
+			std::cout << "ERROR::BCTEX:: Failed to open " << imagePath << std::endl;
+			return false;
+		}
+
+		std::uint64_t contentHash = ContentKey(source.Data(), source.Size(), srgb);
+
+		int imageWidth, imageHeight, components;
+		unsigned char* pixels = stbi_load_from_memory(source.Data(), static_cast<int>(source.Size()), &imageWidth, &imageHeight, &components, 0);
+		if (!pixels)
+		{
+			std::cout << "ERROR::BCTEX:: Failed to decode " << imagePath << std::endl;
+			return false;
+		}
+
+		std::unique_ptr<CompressedTexture> texture = Compress(pixels, imageWidth, imageHeight, components, srgb, pool);
+		stbi_image_free(pixels);
+
+		std::size_t slash = imagePath.find_last_of('/');
+		std::string cachePath = CachePath(slash == std::string::npos ? "." : imagePath.substr(0, slash), contentHash);
+		if (!texture->Write(cachePath, contentHash))
+		{
+			std::cout << "ERROR::BCTEX:: Failed to write " << cachePath << std::endl;
+			return false;
+		}
+
+		std::cout << imagePath << " -> " << cachePath << " (" << (texture->format == BCEncoder::BC3 ? "BC3" : "BC1") << ", " << texture->levels.size() << " levels, " << texture->TotalBytes() << " bytes)" << std::endl;
+		return true;
+	}
+private:
+	struct Header
+	{
+		char magic[4];
+		std::uint32_t version;
+		std::uint32_t format;
+		std::uint32_t width;
+		std::uint32_t height;
+		std::uint32_t flags;
+		std::uint32_t levelCount;
+		std::uint32_t reserved;
+		std::uint64_t key;
+	};
+
+	static const std::uint32_t FLAG_SRGB = 1;
+
+	MappedFile file;                   // cache hit
+	std::vector<unsigned char> owned;  // freshly encoded
+
+	static std::atomic<bool>& enabledFlag()
+	{
+		static std::atomic<bool> enabled(false);
+		return enabled;
+	}
+
+	const unsigned char* base() const
+	{
+		return file.IsOpen() ? file.Data() : owned.data();
+	}
+
+	bool fail()
+	{
+		levels.clear();
+		file.Close();
+		return false;
+	}
+
+	static std::uint64_t align(std::uint64_t offset)
+	{
+		return (offset + 15) & ~static_cast<std::uint64_t>(15);
+	}
+};
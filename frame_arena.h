@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Bump allocator for scratch memory that lives for one frame : Allocate hands out aligned slices of one block, Reset takes them all back.
+// Reserve sizes the block outside the hot path (see Scene::Prepare). Running past it still works, through heap blocks
+// that are freed on Reset, and the next Reserve grows the main block to the peak so it doesn't happen twice.
+class FrameArena
+{
+public:
+	FrameArena() : used(0), overflowBytes(0), peak(0) {}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// Only between frames, it invalidates everything handed out
+	void Reserve(std::size_t bytes)
+	{
+		bytes = std::max(bytes, peak);
+		if (bytes > memory.size())
+			memory.resize(bytes);
+		Reset();
+	}
+
+	void Reset()
+	{
+		used = 0;
+		overflowBytes = 0;
+		overflow.clear();
+	}
+
+	// Uninitialized storage for count Ts, T must be trivially destructible (nothing is ever destroyed)
+	template <typename T>
+	T* Allocate(std::size_t count)
+	{
+		std::size_t bytes = count * sizeof(T);
+		std::size_t offset = (used + alignof(T) - 1) / alignof(T) * alignof(T);
+		if (offset + bytes <= memory.size())
+		{
+			used = offset + bytes;
+			peak = std::max(peak, used + overflowBytes);
+			return reinterpret_cast<T*>(memory.data() + offset);
+		}
+
+		// new[] of unsigned char is aligned for any fundamental type
+		overflow.push_back(std::unique_ptr<unsigned char[]>(new unsigned char[bytes > 0 ? bytes : 1]));
+		overflowBytes += bytes + alignof(T);
+		peak = std::max(peak, used + overflowBytes);
+		return reinterpret_cast<T*>(overflow.back().get());
+	}
+
+	std::size_t Used() const
+	{
+		return used + overflowBytes;
+	}
+
+	std::size_t Capacity() const
+	{
+		return memory.size();
+	}
+private:
+	std::vector<unsigned char> memory;
+	std::size_t used;
+	std::vector<std::unique_ptr<unsigned char[]>> overflow;
+	std::size_t overflowBytes;
+	std::size_t peak;  // most ever used in a frame, overflow included
+};
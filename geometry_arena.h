@@ -0,0 +1,542 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gl_state.h"
+#include "upload_ring.h"
+#include "vertex_format.h"
+
+// Sorted list of free ranges inside a buffer, first fit, neighbours merged on release
+class RangeAllocator
+{
+public:
+	static const unsigned int INVALID = 0xFFFFFFFFu;
+
+	explicit RangeAllocator(unsigned int capacity = 0) : capacity(0)
+	{
+		Grow(capacity);
+	}
+
+	unsigned int Allocate(unsigned int size)
+	{
+		for (unsigned int i = 0; i < freeRanges.size(); i++)
+		{
+			if (freeRanges[i].size < size)
+				continue;
+
+			unsigned int offset = freeRanges[i].offset;
+			freeRanges[i].offset += size;
+			freeRanges[i].size -= size;
+			if (freeRanges[i].size == 0)
+				freeRanges.erase(freeRanges.begin() + i);
+			return offset;
+		}
+		return INVALID;
+	}
+
+	void Free(unsigned int offset, unsigned int size)
+	{
+		if (size == 0)
+			return;
+
+		unsigned int i = 0;
+		while (i < freeRanges.size() && freeRanges[i].offset < offset)
+			i++;
+
+		bool mergesPrevious = i > 0 && freeRanges[i - 1].offset + freeRanges[i - 1].size == offset;
+		bool mergesNext = i < freeRanges.size() && offset + size == freeRanges[i].offset;
+		if (mergesPrevious && mergesNext)
+		{
+			freeRanges[i - 1].size += size + freeRanges[i].size;
+			freeRanges.erase(freeRanges.begin() + i);
+		}
+		else if (mergesPrevious)
+		{
+			freeRanges[i - 1].size += size;
+		}
+		else if (mergesNext)
+		{
+			freeRanges[i].offset = offset;
+			freeRanges[i].size += size;
+		}
+		else
+		{
+			Range range = { offset, size };
+			freeRanges.insert(freeRanges.begin() + i, range);
+		}
+	}
+
+	// New space is added at the end, merged with a free tail
+	void Grow(unsigned int newCapacity)
+	{
+		if (newCapacity <= capacity)
+			return;
+
+		unsigned int added = newCapacity - capacity;
+		unsigned int offset = capacity;
+		capacity = newCapacity;
+		Free(offset, added);
+	}
+
+	// Everything below used is taken, the rest is one free range
+	void Reset(unsigned int used, unsigned int newCapacity)
+	{
+		freeRanges.clear();
+		capacity = newCapacity;
+		if (used < newCapacity)
+		{
+			Range range = { used, newCapacity - used };
+			freeRanges.push_back(range);
+		}
+	}
+
+	unsigned int Capacity() const { return capacity; }
+	unsigned int FreeRanges() const { return static_cast<unsigned int>(freeRanges.size()); }
+
+	unsigned int FreeTotal() const
+	{
+		unsigned int total = 0;
+		for (unsigned int i = 0; i < freeRanges.size(); i++)
+			total += freeRanges[i].size;
+		return total;
+	}
+
+	// Free space that isn't the tail of the buffer, lost until a defragment
+	unsigned int FreeHoles() const
+	{
+		unsigned int total = FreeTotal();
+		if (!freeRanges.empty() && freeRanges.back().offset + freeRanges.back().size == capacity)
+			total -= freeRanges.back().size;
+		return total;
+	}
+private:
+	struct Range
+	{
+		unsigned int offset;
+		unsigned int size;
+	};
+
+	std::vector<Range> freeRanges;
+	unsigned int capacity;
+};
+
+// Every mesh's vertices and indices, suballocated from one vertex and one index buffer per (VertexFormat, index type)
+// Each pool has its own VAO, so a whole scene pass binds a handful of VAOs instead of one per mesh.
+// Meshes hold a block id rather than offsets : Defragment() moves blocks and only the block table changes.
+// GL thread only.
+class GeometryArena
+{
+public:
+	typedef unsigned int BlockId;
+	static const BlockId INVALID_BLOCK = 0xFFFFFFFFu;
+
+	// Where a mesh's geometry currently lives, valid until the next Allocate / Free / Defragment
+	struct Block
+	{
+		unsigned int pool;
+		GLint baseVertex;
+		unsigned int firstIndex;
+		unsigned int vertexCount;
+		unsigned int indexCount;
+		bool live;
+	};
+
+	struct Stats
+	{
+		unsigned int pools;
+		unsigned int blocks;
+		std::size_t usedBytes;
+		std::size_t capacityBytes;
+		std::size_t holeBytes;  // free space only a defragment gets back
+		unsigned int defragments;
+	};
+
+	// Vertex attribute fed by ReserveDrawIndices, for shaders without gl_DrawID (see phong_light_tex.vert)
+	static const GLuint DRAW_INDEX_ATTRIBUTE = 5;
+
+	static GeometryArena& Get()
+	{
+		static GeometryArena arena;
+		return arena;
+	}
+
+	GeometryArena(const GeometryArena&) = delete;
+	GeometryArena& operator=(const GeometryArena&) = delete;
+
+	// Copies the packed vertices and indices into the pool matching their layout, growing it when full
+	BlockId Allocate(const PackedGeometry& packed)
+	{
+		BlockId id = Reserve(packed.format, packed.indexType, packed.vertexCount, packed.indexCount);
+		WriteVertices(id, 0, packed.vertices, packed.vertexBytes, nullptr);
+		WriteIndices(id, 0, packed.indices, packed.indexBytes, nullptr);
+		return id;
+	}
+
+	// Room for a mesh in the pool matching its layout, growing it when full. The contents stay undefined until written.
+	BlockId Reserve(const VertexFormat& format, GLenum indexType, unsigned int vertexCount, unsigned int indexCount)
+	{
+		unsigned int poolIdx = findPool(format, indexType);
+		Pool& pool = pools[poolIdx];
+
+		unsigned int vertexOffset = pool.vertexSpace.Allocate(vertexCount);
+		if (vertexOffset == RangeAllocator::INVALID)
+		{
+			growVertices(pool, vertexCount);
+			vertexOffset = pool.vertexSpace.Allocate(vertexCount);
+		}
+
+		unsigned int indexOffset = pool.indexSpace.Allocate(indexCount);
+		if (indexOffset == RangeAllocator::INVALID)
+		{
+			growIndices(pool, indexCount);
+			indexOffset = pool.indexSpace.Allocate(indexCount);
+		}
+
+		Block block;
+		block.pool = poolIdx;
+		block.baseVertex = static_cast<GLint>(vertexOffset);
+		block.firstIndex = indexOffset;
+		block.vertexCount = vertexCount;
+		block.indexCount = indexCount;
+		block.live = true;
+
+		BlockId id;
+		if (!freeBlocks.empty())
+		{
+			id = freeBlocks.back();
+			freeBlocks.pop_back();
+			blocks[id] = block;
+		}
+		else
+		{
+			id = static_cast<BlockId>(blocks.size());
+			blocks.push_back(block);
+		}
+		return id;
+	}
+
+	// bytes of packed vertex data at byteOffset inside the block, staged through ring when it has room and straight from data otherwise.
+	// False (nothing written) while the ring is stalled.
+	bool WriteVertices(BlockId id, std::size_t byteOffset, const void* data, std::size_t bytes, UploadRing* ring)
+	{
+		const Block& block = blocks[id];
+		const Pool& pool = pools[block.pool];
+		return write(pool.vertexBuffer, static_cast<std::size_t>(block.baseVertex) * pool.vertexSize + byteOffset, data, bytes, ring);
+	}
+
+	bool WriteIndices(BlockId id, std::size_t byteOffset, const void* data, std::size_t bytes, UploadRing* ring)
+	{
+		const Block& block = blocks[id];
+		const Pool& pool = pools[block.pool];
+		return write(pool.indexBuffer, static_cast<std::size_t>(block.firstIndex) * pool.indexSize + byteOffset, data, bytes, ring);
+	}
+
+	void Free(BlockId id)
+	{
+		if (id >= blocks.size() || !blocks[id].live)
+			return;
+
+		Block& block = blocks[id];
+		Pool& pool = pools[block.pool];
+		pool.vertexSpace.Free(static_cast<unsigned int>(block.baseVertex), block.vertexCount);
+		pool.indexSpace.Free(block.firstIndex, block.indexCount);
+
+		block.live = false;
+		freeBlocks.push_back(id);
+	}
+
+	const Block& GetBlock(BlockId id) const
+	{
+		return blocks[id];
+	}
+
+	GLuint VAO(unsigned int pool) const
+	{
+		return pools[pool].VAO;
+	}
+
+	// Compacts every pool whose holes waste more than minWaste of its capacity, returns the bytes moved
+	// Live blocks are copied on the GPU in offset order into fresh buffers, then the old ones are deleted.
+	std::size_t Defragment(float minWaste = 0.25f)
+	{
+		std::size_t moved = 0;
+		for (unsigned int p = 0; p < pools.size(); p++)
+		{
+			Pool& pool = pools[p];
+			std::size_t holes = static_cast<std::size_t>(pool.vertexSpace.FreeHoles()) * pool.vertexSize + static_cast<std::size_t>(pool.indexSpace.FreeHoles()) * pool.indexSize;
+			std::size_t capacity = static_cast<std::size_t>(pool.vertexSpace.Capacity()) * pool.vertexSize + static_cast<std::size_t>(pool.indexSpace.Capacity()) * pool.indexSize;
+			if (holes == 0 || holes < capacity * minWaste)
+				continue;
+
+			moved += compact(p);
+			defragments++;
+		}
+		return moved;
+	}
+
+	// Sizes the draw index attribute for Scene's indirect draws : instance i of a command reads baseInstance + i
+	void ReserveDrawIndices(unsigned int count)
+	{
+		if (count <= drawIndexCount)
+			return;
+
+		unsigned int newCount = std::max(count, drawIndexCount * 2);
+		std::vector<GLuint> identity(newCount);
+		for (unsigned int i = 0; i < newCount; i++)
+			identity[i] = i;
+
+		if (drawIndexBuffer == 0)
+			glGenBuffers(1, &drawIndexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, identity.size() * sizeof(GLuint), identity.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		drawIndexCount = newCount;
+
+		for (unsigned int p = 0; p < pools.size(); p++)
+			bindAttributes(pools[p]);
+	}
+
+	Stats GetStats() const
+	{
+		Stats stats = {};
+		stats.pools = static_cast<unsigned int>(pools.size());
+		stats.blocks = static_cast<unsigned int>(blocks.size() - freeBlocks.size());
+		for (unsigned int p = 0; p < pools.size(); p++)
+		{
+			const Pool& pool = pools[p];
+			stats.capacityBytes += static_cast<std::size_t>(pool.vertexSpace.Capacity()) * pool.vertexSize + static_cast<std::size_t>(pool.indexSpace.Capacity()) * pool.indexSize;
+			stats.usedBytes += static_cast<std::size_t>(pool.vertexSpace.Capacity() - pool.vertexSpace.FreeTotal()) * pool.vertexSize
+				+ static_cast<std::size_t>(pool.indexSpace.Capacity() - pool.indexSpace.FreeTotal()) * pool.indexSize;
+			stats.holeBytes += static_cast<std::size_t>(pool.vertexSpace.FreeHoles()) * pool.vertexSize + static_cast<std::size_t>(pool.indexSpace.FreeHoles()) * pool.indexSize;
+		}
+		stats.defragments = defragments;
+		return stats;
+	}
+
+	// Call while the context is still current, after every mesh is released
+	void Clear()
+	{
+		for (unsigned int p = 0; p < pools.size(); p++)
+		{
+			glDeleteVertexArrays(1, &pools[p].VAO);
+			GLState::Get().VertexArrayDeleted(pools[p].VAO);
+			glDeleteBuffers(1, &pools[p].vertexBuffer);
+			glDeleteBuffers(1, &pools[p].indexBuffer);
+		}
+		if (drawIndexBuffer != 0)
+			glDeleteBuffers(1, &drawIndexBuffer);
+
+		pools.clear();
+		blocks.clear();
+		freeBlocks.clear();
+		drawIndexBuffer = 0;
+		drawIndexCount = 0;
+	}
+private:
+	struct Pool
+	{
+		VertexFormat format;
+		GLenum indexType;
+		unsigned int vertexSize;
+		unsigned int indexSize;
+
+		GLuint VAO;
+		GLuint vertexBuffer;
+		GLuint indexBuffer;
+		RangeAllocator vertexSpace;  // in vertices
+		RangeAllocator indexSpace;   // in indices
+	};
+
+	// First buffers are sized for a few typical meshes, then double
+	static unsigned int initialVertices() { return 1u << 16; }
+	static unsigned int initialIndices() { return 3u << 16; }
+
+	std::vector<Pool> pools;
+	std::vector<Block> blocks;
+	std::vector<BlockId> freeBlocks;
+
+	GLuint drawIndexBuffer;
+	unsigned int drawIndexCount;
+	unsigned int defragments;
+
+	GeometryArena() : drawIndexBuffer(0), drawIndexCount(0), defragments(0) {}
+
+	unsigned int findPool(const VertexFormat& format, GLenum indexType)
+	{
+		for (unsigned int p = 0; p < pools.size(); p++)
+		{
+			if (pools[p].format == format && pools[p].indexType == indexType)
+				return p;
+		}
+
+		Pool pool;
+		pool.format = format;
+		pool.indexType = indexType;
+		pool.vertexSize = format.Stride();
+		pool.indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+		pool.vertexBuffer = createBuffer(GL_ARRAY_BUFFER, static_cast<std::size_t>(initialVertices()) * pool.vertexSize);
+		pool.indexBuffer = createBuffer(GL_ARRAY_BUFFER, static_cast<std::size_t>(initialIndices()) * pool.indexSize);
+		pool.vertexSpace = RangeAllocator(initialVertices());
+		pool.indexSpace = RangeAllocator(initialIndices());
+
+		glGenVertexArrays(1, &pool.VAO);
+		bindAttributes(pool);
+
+		pools.push_back(pool);
+		return static_cast<unsigned int>(pools.size() - 1);
+	}
+
+	static GLuint createBuffer(GLenum target, std::size_t bytes)
+	{
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(target, buffer);
+		glBufferData(target, bytes, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(target, 0);
+		return buffer;
+	}
+
+	// Points the pool's VAO at its current buffers, again after every grow or compact
+	void bindAttributes(const Pool& pool) const
+	{
+		GLState::Get().BindVertexArray(pool.VAO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+		VertexPacker::SetupAttributes(pool.format);
+
+		if (drawIndexBuffer != 0)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, drawIndexBuffer);
+			glEnableVertexAttribArray(DRAW_INDEX_ATTRIBUTE);
+			glVertexAttribIPointer(DRAW_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+			glVertexAttribDivisor(DRAW_INDEX_ATTRIBUTE, 1);
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBuffer);
+		GLState::Get().BindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	static bool write(GLuint buffer, std::size_t offset, const void* data, std::size_t bytes, UploadRing* ring)
+	{
+		if (bytes == 0)
+			return true;
+
+		if (ring)
+		{
+			std::size_t staged = ring->Stage(data, bytes);
+			if (staged != UploadRing::INVALID)
+			{
+				glBindBuffer(GL_COPY_READ_BUFFER, ring->Buffer());
+				glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(staged), static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(bytes));
+				glBindBuffer(GL_COPY_READ_BUFFER, 0);
+				glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+				return true;
+			}
+			if (ring->Stalled())
+				return false;
+		}
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(offset), static_cast<GLsizeiptr>(bytes), data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return true;
+	}
+
+	// Copies the first usedBytes of a buffer into a new one of newBytes, returns the new buffer
+	static GLuint resizeBuffer(GLuint buffer, std::size_t usedBytes, std::size_t newBytes)
+	{
+		GLuint resized = createBuffer(GL_COPY_WRITE_BUFFER, newBytes);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+		if (usedBytes != 0)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		glDeleteBuffers(1, &buffer);
+		return resized;
+	}
+
+	void growVertices(Pool& pool, unsigned int needed)
+	{
+		unsigned int capacity = pool.vertexSpace.Capacity();
+		unsigned int newCapacity = std::max(capacity * 2, capacity + needed);
+		pool.vertexBuffer = resizeBuffer(pool.vertexBuffer, static_cast<std::size_t>(capacity) * pool.vertexSize, static_cast<std::size_t>(newCapacity) * pool.vertexSize);
+		pool.vertexSpace.Grow(newCapacity);
+		bindAttributes(pool);
+	}
+
+	void growIndices(Pool& pool, unsigned int needed)
+	{
+		unsigned int capacity = pool.indexSpace.Capacity();
+		unsigned int newCapacity = std::max(capacity * 2, capacity + needed);
+		pool.indexBuffer = resizeBuffer(pool.indexBuffer, static_cast<std::size_t>(capacity) * pool.indexSize, static_cast<std::size_t>(newCapacity) * pool.indexSize);
+		pool.indexSpace.Grow(newCapacity);
+		bindAttributes(pool);
+	}
+
+	std::size_t compact(unsigned int poolIdx)
+	{
+		Pool& pool = pools[poolIdx];
+
+		// Live blocks in their current order, so the copies keep the same relative layout
+		std::vector<BlockId> live;
+		for (BlockId id = 0; id < blocks.size(); id++)
+		{
+			if (blocks[id].live && blocks[id].pool == poolIdx)
+				live.push_back(id);
+		}
+		std::sort(live.begin(), live.end(), [this](BlockId a, BlockId b) { return blocks[a].baseVertex < blocks[b].baseVertex; });
+
+		unsigned int vertexCapacity = pool.vertexSpace.Capacity();
+		unsigned int indexCapacity = pool.indexSpace.Capacity();
+		GLuint vertexBuffer = createBuffer(GL_COPY_WRITE_BUFFER, static_cast<std::size_t>(vertexCapacity) * pool.vertexSize);
+		GLuint indexBuffer = createBuffer(GL_COPY_WRITE_BUFFER, static_cast<std::size_t>(indexCapacity) * pool.indexSize);
+
+		std::size_t moved = 0;
+		unsigned int vertexCursor = 0;
+		unsigned int indexCursor = 0;
+		for (unsigned int i = 0; i < live.size(); i++)
+		{
+			Block& block = blocks[live[i]];
+			std::size_t vertexBytes = static_cast<std::size_t>(block.vertexCount) * pool.vertexSize;
+			std::size_t indexBytes = static_cast<std::size_t>(block.indexCount) * pool.indexSize;
+
+			glBindBuffer(GL_COPY_READ_BUFFER, pool.vertexBuffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+			if (vertexBytes != 0)
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(block.baseVertex) * pool.vertexSize, static_cast<GLintptr>(vertexCursor) * pool.vertexSize, vertexBytes);
+
+			glBindBuffer(GL_COPY_READ_BUFFER, pool.indexBuffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+			if (indexBytes != 0)
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(block.firstIndex) * pool.indexSize, static_cast<GLintptr>(indexCursor) * pool.indexSize, indexBytes);
+
+			// Indices are relative to baseVertex, only the offsets change
+			block.baseVertex = static_cast<GLint>(vertexCursor);
+			block.firstIndex = indexCursor;
+			vertexCursor += block.vertexCount;
+			indexCursor += block.indexCount;
+			moved += vertexBytes + indexBytes;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		glDeleteBuffers(1, &pool.vertexBuffer);
+		glDeleteBuffers(1, &pool.indexBuffer);
+		pool.vertexBuffer = vertexBuffer;
+		pool.indexBuffer = indexBuffer;
+		pool.vertexSpace.Reset(vertexCursor, vertexCapacity);
+		pool.indexSpace.Reset(indexCursor, indexCapacity);
+		bindAttributes(pool);
+
+		return moved;
+	}
+};
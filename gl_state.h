@@ -0,0 +1,249 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Cache of the GL state the renderer sets, between our code and GL : a call asking for the state already current is skipped.
+// GL thread only. Everything starts unknown, so the first request for each piece of state always reaches GL.
+// Code changing tracked state behind the cache must restore it (as the ImGui backend does) or call Invalidate().
+class GLState
+{
+public:
+	static const unsigned int TEXTURE_UNITS = 16;  // units above this go straight to GL
+
+	struct Stats
+	{
+		unsigned long long issued;
+		unsigned long long skipped;  // state already current, no GL call
+	};
+
+	static GLState& Get()
+	{
+		static GLState state;
+		return state;
+	}
+
+	GLState(const GLState&) = delete;
+	GLState& operator=(const GLState&) = delete;
+
+	void UseProgram(GLuint program)
+	{
+		if (changed(this->program, program))
+			glUseProgram(program);
+	}
+
+	void BindVertexArray(GLuint vertexArray)
+	{
+		if (changed(this->vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	// GL_TEXTURE_2D on unit, also leaves unit active
+	void BindTexture(GLuint unit, GLuint texture)
+	{
+		if (changed(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+
+		if (unit >= TEXTURE_UNITS)
+		{
+			issue();
+			glBindTexture(GL_TEXTURE_2D, texture);
+			return;
+		}
+		if (changed(textures[unit], texture))
+			glBindTexture(GL_TEXTURE_2D, texture);
+	}
+
+	// GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST and GL_STENCIL_TEST are cached, other capabilities go straight to GL
+	void Enable(GLenum capability)
+	{
+		Cached<bool>* cached = capabilityCache(capability);
+		if (!cached)
+			issue();
+		if (!cached || changed(*cached, true))
+			glEnable(capability);
+	}
+
+	void Disable(GLenum capability)
+	{
+		Cached<bool>* cached = capabilityCache(capability);
+		if (!cached)
+			issue();
+		if (!cached || changed(*cached, false))
+			glDisable(capability);
+	}
+
+	void CullFace(GLenum mode)
+	{
+		if (changed(cullFace, mode))
+			glCullFace(mode);
+	}
+
+	void FrontFace(GLenum mode)
+	{
+		if (changed(frontFace, mode))
+			glFrontFace(mode);
+	}
+
+	void DepthFunc(GLenum func)
+	{
+		if (changed(depthFunc, func))
+			glDepthFunc(func);
+	}
+
+	void DepthMask(GLboolean flag)
+	{
+		if (changed(depthMask, flag))
+			glDepthMask(flag);
+	}
+
+	void StencilFunc(GLenum func, GLint ref, GLuint mask)
+	{
+		StencilFuncState value = { func, ref, mask };
+		if (changed(stencilFunc, value))
+			glStencilFunc(func, ref, mask);
+	}
+
+	void StencilOp(GLenum stencilFail, GLenum depthFail, GLenum depthPass)
+	{
+		StencilOpState value = { stencilFail, depthFail, depthPass };
+		if (changed(stencilOp, value))
+			glStencilOp(stencilFail, depthFail, depthPass);
+	}
+
+	void StencilMask(GLuint mask)
+	{
+		if (changed(stencilMask, mask))
+			glStencilMask(mask);
+	}
+
+	// Deleting a bound object unbinds it in GL, the cache has to follow or a recycled name would be taken as bound
+	void ProgramDeleted(GLuint deleted)
+	{
+		if (program.known && program.value == deleted)
+			program.known = false;
+	}
+
+	void VertexArrayDeleted(GLuint deleted)
+	{
+		if (vertexArray.known && vertexArray.value == deleted)
+			vertexArray.value = 0;
+	}
+
+	void TextureDeleted(GLuint deleted)
+	{
+		for (unsigned int i = 0; i < TEXTURE_UNITS; i++)
+		{
+			if (textures[i].known && textures[i].value == deleted)
+				textures[i].value = 0;
+		}
+	}
+
+	// Forgets everything, the next request for each piece of state reaches GL again
+	void Invalidate()
+	{
+		program.known = vertexArray.known = activeUnit.known = false;
+		for (unsigned int i = 0; i < TEXTURE_UNITS; i++)
+			textures[i].known = false;
+		blend.known = cullFaceEnabled.known = depthTest.known = stencilTest.known = false;
+		cullFace.known = frontFace.known = depthFunc.known = depthMask.known = false;
+		stencilFunc.known = stencilOp.known = stencilMask.known = false;
+	}
+
+	// Calls since the last EndFrame
+	const Stats& FrameStats() const
+	{
+		return frame;
+	}
+
+	// The frame before, complete
+	const Stats& LastFrame() const
+	{
+		return lastFrame;
+	}
+
+	void EndFrame()
+	{
+		lastFrame = frame;
+		frame = Stats();
+	}
+private:
+	template <typename T>
+	struct Cached
+	{
+		T value;
+		bool known;
+	};
+
+	struct StencilFuncState
+	{
+		GLenum func;
+		GLint ref;
+		GLuint mask;
+
+		bool operator==(const StencilFuncState& other) const { return func == other.func && ref == other.ref && mask == other.mask; }
+	};
+
+	struct StencilOpState
+	{
+		GLenum stencilFail;
+		GLenum depthFail;
+		GLenum depthPass;
+
+		bool operator==(const StencilOpState& other) const { return stencilFail == other.stencilFail && depthFail == other.depthFail && depthPass == other.depthPass; }
+	};
+
+	Cached<GLuint> program;
+	Cached<GLuint> vertexArray;
+	Cached<GLuint> activeUnit;
+	Cached<GLuint> textures[TEXTURE_UNITS];
+	Cached<bool> blend;
+	Cached<bool> cullFaceEnabled;
+	Cached<bool> depthTest;
+	Cached<bool> stencilTest;
+	Cached<GLenum> cullFace;
+	Cached<GLenum> frontFace;
+	Cached<GLenum> depthFunc;
+	Cached<GLboolean> depthMask;
+	Cached<StencilFuncState> stencilFunc;
+	Cached<StencilOpState> stencilOp;
+	Cached<GLuint> stencilMask;
+
+	Stats frame;
+	Stats lastFrame;
+
+	GLState() : program(), vertexArray(), activeUnit(), textures(), blend(), cullFaceEnabled(), depthTest(), stencilTest(),
+		cullFace(), frontFace(), depthFunc(), depthMask(), stencilFunc(), stencilOp(), stencilMask(), frame(), lastFrame() {}
+
+	// Records value and returns true when the GL call has to be made
+	template <typename T>
+	bool changed(Cached<T>& cached, const T& value)
+	{
+		if (cached.known && cached.value == value)
+		{
+			frame.skipped++;
+			return false;
+		}
+
+		cached.value = value;
+		cached.known = true;
+		issue();
+		return true;
+	}
+
+	void issue()
+	{
+		frame.issued++;
+	}
+
+	Cached<bool>* capabilityCache(GLenum capability)
+	{
+		switch (capability)
+		{
+		case GL_BLEND: return &blend;
+		case GL_CULL_FACE: return &cullFaceEnabled;
+		case GL_DEPTH_TEST: return &depthTest;
+		case GL_STENCIL_TEST: return &stencilTest;
+		default: return nullptr;
+		}
+	}
+};
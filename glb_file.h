@@ -0,0 +1,313 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Just enough of a binary glTF (.glb) to find an embedded image's bytes : the header, the JSON chunk's images and
+// bufferViews, and where the BIN chunk starts. Everything else in the JSON is skipped without being stored.
+class GlbFile
+{
+public:
+	GlbFile() : binOffset(0), binSize(0) {}
+
+	// False when data is not a GLB, nothing is kept from a failed parse
+	bool Parse(const unsigned char* data, std::size_t size)
+	{
+		images.clear();
+		bufferViews.clear();
+		binOffset = binSize = 0;
+
+		std::uint32_t header[3];  // magic, version, length
+		if (size < sizeof(header))
+			return false;
+		std::memcpy(header, data, sizeof(header));
+		if (header[0] != MAGIC || header[1] != 2 || header[2] > size)
+			return false;
+		size = header[2];
+
+		// JSON chunk first, then an optional BIN chunk
+		std::size_t cursor = sizeof(header);
+		std::uint32_t chunk[2];  // length, type
+		if (cursor + sizeof(chunk) > size)
+			return false;
+		std::memcpy(chunk, data + cursor, sizeof(chunk));
+		cursor += sizeof(chunk);
+		if (chunk[1] != CHUNK_JSON || chunk[0] > size - cursor)
+			return false;
+
+		const char* json = reinterpret_cast<const char*>(data + cursor);
+		JsonReader reader(json, json + chunk[0]);
+		if (!readRoot(reader))
+		{
+			images.clear();
+			bufferViews.clear();
+			return false;
+		}
+		cursor += chunk[0];
+
+		cursor = (cursor + 3) & ~static_cast<std::size_t>(3);
+		if (cursor + sizeof(chunk) <= size)
+		{
+			std::memcpy(chunk, data + cursor, sizeof(chunk));
+			cursor += sizeof(chunk);
+			if (chunk[1] == CHUNK_BIN && chunk[0] <= size - cursor)
+			{
+				binOffset = cursor;
+				binSize = chunk[0];
+			}
+		}
+		return true;
+	}
+
+	// Byte range in the file of the embeddedIndex-th embedded image, in Assimp's "*N" numbering (images with a bufferView
+	// or a data URI, in order). False for data URIs and for ranges that are not inside the BIN chunk.
+	bool EmbeddedImageRange(unsigned int embeddedIndex, std::uint64_t& offset, std::uint64_t& size) const
+	{
+		unsigned int embedded = 0;
+		for (unsigned int i = 0; i < images.size(); i++)
+		{
+			const Image& image = images[i];
+			if (image.bufferView < 0 && !image.dataUri)
+				continue; // external file, not counted by Assimp
+			if (embedded++ != embeddedIndex)
+				continue;
+
+			if (image.bufferView < 0 || static_cast<std::size_t>(image.bufferView) >= bufferViews.size())
+				return false;
+
+			const BufferView& view = bufferViews[image.bufferView];
+			if (view.buffer != 0 || view.byteOffset > binSize || view.byteLength > binSize - view.byteOffset || view.byteLength == 0)
+				return false;
+
+			offset = binOffset + view.byteOffset;
+			size = view.byteLength;
+			return true;
+		}
+		return false;
+	}
+private:
+	static const std::uint32_t MAGIC = 0x46546C67;       // "glTF"
+	static const std::uint32_t CHUNK_JSON = 0x4E4F534A;  // "JSON"
+	static const std::uint32_t CHUNK_BIN = 0x004E4942;   // "BIN\0"
+	static const unsigned int MAX_DEPTH = 64;
+
+	struct Image
+	{
+		long long bufferView;
+		bool dataUri;
+	};
+
+	struct BufferView
+	{
+		long long buffer;
+		std::uint64_t byteOffset;
+		std::uint64_t byteLength;
+	};
+
+	std::vector<Image> images;
+	std::vector<BufferView> bufferViews;
+	std::uint64_t binOffset;
+	std::uint64_t binSize;
+
+	// Forward-only scanner over the JSON text, every read returns false on malformed input
+	struct JsonReader
+	{
+		const char* cursor;
+		const char* end;
+
+		JsonReader(const char* begin, const char* end) : cursor(begin), end(end) {}
+
+		void SkipSpace()
+		{
+			while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r'))
+				cursor++;
+		}
+
+		// Skips whitespace, then consumes c if it is next
+		bool Accept(char c)
+		{
+			SkipSpace();
+			if (cursor < end && *cursor == c)
+			{
+				cursor++;
+				return true;
+			}
+			return false;
+		}
+
+		// Range of a string's raw contents, escapes left as they are
+		bool String(const char*& begin, std::size_t& length)
+		{
+			if (!Accept('"'))
+				return false;
+			begin = cursor;
+			while (cursor < end && *cursor != '"')
+				cursor += *cursor == '\\' ? 2 : 1;
+			if (cursor >= end)
+				return false;
+			length = static_cast<std::size_t>(cursor - begin);
+			cursor++;
+			return true;
+		}
+
+		bool Integer(long long& value)
+		{
+			SkipSpace();
+			bool negative = cursor < end && *cursor == '-';
+			if (negative)
+				cursor++;
+			if (cursor >= end || *cursor < '0' || *cursor > '9')
+				return false;
+
+			value = 0;
+			while (cursor < end && *cursor >= '0' && *cursor <= '9')
+			{
+				if (value > (0x7FFFFFFFFFFFFFFFLL - 9) / 10)
+					return false;
+				value = value * 10 + (*cursor++ - '0');
+			}
+			if (cursor < end && (*cursor == '.' || *cursor == 'e' || *cursor == 'E'))
+				return false; // glTF indices and sizes are integers
+			if (negative)
+				value = -value;
+			return true;
+		}
+
+		bool Skip(unsigned int depth = 0)
+		{
+			if (depth > MAX_DEPTH)
+				return false;
+
+			const char* begin;
+			std::size_t length;
+			if (Accept('{'))
+			{
+				if (Accept('}'))
+					return true;
+				do
+				{
+					if (!String(begin, length) || !Accept(':') || !Skip(depth + 1))
+						return false;
+				} while (Accept(','));
+				return Accept('}');
+			}
+			if (Accept('['))
+			{
+				if (Accept(']'))
+					return true;
+				do
+				{
+					if (!Skip(depth + 1))
+						return false;
+				} while (Accept(','));
+				return Accept(']');
+			}
+			if (cursor < end && *cursor == '"')
+				return String(begin, length);
+
+			// Number or literal
+			const char* start = cursor;
+			while (cursor < end && *cursor != ',' && *cursor != '}' && *cursor != ']' && *cursor != ' ' && *cursor != '\t' && *cursor != '\n' && *cursor != '\r')
+				cursor++;
+			return cursor != start;
+		}
+	};
+
+	static bool keyIs(const char* key, std::size_t length, const char* name)
+	{
+		return std::strlen(name) == length && std::memcmp(key, name, length) == 0;
+	}
+
+	// Calls readMember(reader, key, length) for every member of the object, which must consume the value
+	template <typename MemberReader>
+	static bool readObject(JsonReader& reader, MemberReader readMember)
+	{
+		if (!reader.Accept('{'))
+			return false;
+		if (reader.Accept('}'))
+			return true;
+		do
+		{
+			const char* key;
+			std::size_t length;
+			if (!reader.String(key, length) || !reader.Accept(':') || !readMember(reader, key, length))
+				return false;
+		} while (reader.Accept(','));
+		return reader.Accept('}');
+	}
+
+	template <typename ElementReader>
+	static bool readArray(JsonReader& reader, ElementReader readElement)
+	{
+		if (!reader.Accept('['))
+			return false;
+		if (reader.Accept(']'))
+			return true;
+		do
+		{
+			if (!readElement(reader))
+				return false;
+		} while (reader.Accept(','));
+		return reader.Accept(']');
+	}
+
+	bool readRoot(JsonReader& reader)
+	{
+		return readObject(reader, [this](JsonReader& reader, const char* key, std::size_t length)
+		{
+			if (keyIs(key, length, "images"))
+				return readArray(reader, [this](JsonReader& reader) { return readImage(reader); });
+			if (keyIs(key, length, "bufferViews"))
+				return readArray(reader, [this](JsonReader& reader) { return readBufferView(reader); });
+			return reader.Skip();
+		});
+	}
+
+	bool readImage(JsonReader& reader)
+	{
+		Image image = { -1, false };
+		bool read = readObject(reader, [&image](JsonReader& reader, const char* key, std::size_t length)
+		{
+			if (keyIs(key, length, "bufferView"))
+				return reader.Integer(image.bufferView);
+			if (keyIs(key, length, "uri"))
+			{
+				const char* uri;
+				std::size_t uriLength;
+				if (!reader.String(uri, uriLength))
+					return false;
+				image.dataUri = uriLength >= 5 && std::memcmp(uri, "data:", 5) == 0;
+				return true;
+			}
+			return reader.Skip();
+		});
+		images.push_back(image);
+		return read;
+	}
+
+	bool readBufferView(JsonReader& reader)
+	{
+		BufferView view = { -1, 0, 0 };
+		long long byteOffset = 0;
+		long long byteLength = -1;
+		bool read = readObject(reader, [&view, &byteOffset, &byteLength](JsonReader& reader, const char* key, std::size_t length)
+		{
+			if (keyIs(key, length, "buffer"))
+				return reader.Integer(view.buffer);
+			if (keyIs(key, length, "byteOffset"))
+				return reader.Integer(byteOffset);
+			if (keyIs(key, length, "byteLength"))
+				return reader.Integer(byteLength);
+			return reader.Skip();
+		});
+		if (!read || byteOffset < 0 || byteLength < 0)
+			return false;
+
+		view.byteOffset = static_cast<std::uint64_t>(byteOffset);
+		view.byteLength = static_cast<std::uint64_t>(byteLength);
+		bufferViews.push_back(view);
+		return true;
+	}
+};
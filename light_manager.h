@@ -5,6 +5,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "shader.h"
+#include "uniform_blocks.h"
 
 struct DirectionalLight
 {
@@ -28,8 +29,34 @@ struct PointLight
 	float quadratic;
 };
 
+// std140 mirror of the Lights block in phong_light_tex.frag
+struct LightsBlock
+{
+	glm::vec3 dlDirection;
+	float padding0;
+	glm::vec3 dlAmbient;
+	float padding1;
+	glm::vec3 dlDiffuse;
+	float padding2;
+	glm::vec3 dlSpecular;
+	float padding3;
+
+	glm::vec3 plPosition;
+	float padding4;
+	glm::vec3 plAmbient;
+	float padding5;
+	glm::vec3 plDiffuse;
+	float padding6;
+	glm::vec3 plSpecular;
+	float plConstant;  // packed after the vec3, as std140 does
+	float plLinear;
+	float plQuadratic;
+	float padding7[2];
+};
+static_assert(sizeof(LightsBlock) == 144, "LightsBlock must match the std140 layout of the Lights block");
+
 // Manages Different Lighting Conditions and Control
-// Proportional to "phong_light.frag" uniforms
+// Proportional to the "Lights" uniform block of "phong_light_tex.frag"
 class LightManager
 {
 public:
@@ -39,7 +66,7 @@ public:
 
 
 
-	LightManager()
+	LightManager() : lightsBlock(LIGHTS_BLOCK_BINDING), dirty(true)
 	{
 		// Default Values
 		this->pl = PointLight{};
@@ -60,24 +87,56 @@ public:
 		this->outlineScale = 1.01;
 	}
 
-	void Use(Shader& shader) const 
+	// Call after changing pl or dl, the block is re-uploaded on the next Update
+	void MarkDirty()
+	{
+		dirty = true;
+	}
+
+	// GL thread, once per frame : uploads the Lights block only when something changed, and binds it
+	void Update()
+	{
+		if (!dirty)
+		{
+			lightsBlock.Bind();
+			return;
+		}
+
+		LightsBlock block = {};
+		block.dlDirection = dl.direction;
+		block.dlAmbient = dl.ambient;
+		block.dlDiffuse = dl.diffuse;
+		block.dlSpecular = dl.specular;
+
+		block.plPosition = pl.position;
+		block.plAmbient = pl.ambient;
+		block.plDiffuse = pl.diffuse;
+		block.plSpecular = pl.specular;
+		block.plConstant = pl.constant;
+		block.plLinear = pl.linear;
+		block.plQuadratic = pl.quadratic;
+
+		lightsBlock.Update(block);
+		dirty = false;
+	}
+
+	unsigned long long Uploads() const
+	{
+		return lightsBlock.Uploads();
+	}
+
+	// Call while the context is still current
+	void Delete()
 	{
-		shader.SetVec3("directionLight.direction", dl.direction);
-		shader.SetVec3("directionLight.ambient", dl.ambient);
-		shader.SetVec3("directionLight.diffuse", dl.diffuse);
-		shader.SetVec3("directionLight.specular", dl.specular);
-
-		shader.SetVec3("pointLight.position", pl.position);
-		shader.SetVec3("pointLight.ambient", pl.ambient);
-		shader.SetVec3("pointLight.diffuse", pl.diffuse);
-		shader.SetVec3("pointLight.specular", pl.specular);
-		shader.SetFloat("pointLight.constant", pl.constant);
-		shader.SetFloat("pointLight.linear", pl.linear);
-		shader.SetFloat("pointLight.quadratic", pl.quadratic);
+		lightsBlock.Delete();
+		dirty = true;
 	}
 
 	~LightManager() 
 	{
 	}
+private:
+	UniformBlock<LightsBlock> lightsBlock;
+	bool dirty;
 };
 
@@ -1,5 +1,8 @@
 #include <iostream>
+#include <string>
 #include <vector>
+#include <cassert>
+#include <cctype>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -13,21 +16,32 @@
 #include <imgui/imgui_impl_opengl3.h>
 
 #include "shader.h"
+#include "shader_manager.h"
+#include "gl_state.h"
 #include "camera.h"
 #include "light_manager.h"
 #include "light_editor.h"
 
 #include "scene.h"
 #include "model.h"
+#include "model_streamer.h"
+#include "bc_encoder.h"
+
+#include "alloc_counter.h"
 
 void framebufferSizeCB(GLFWwindow* window, int width, int height);
 void mouseCB(GLFWwindow* window, double xpos, double ypos);
 void scrollCB(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
+int bakeAssets(int argc, char** argv);
+void checkExactWeld();
+void checkBlockCompression();
 
 const unsigned int SCREEN_WIDTH = 960;
 const unsigned int SCREEN_HEIGHT = 720;
 
+const double UPLOAD_BUDGET_MS = 2.0; // GPU upload time allowed per frame for streamed models
+
 Camera mainCamera(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = SCREEN_WIDTH / 2.0f;	// Set Center X
 float lastY = SCREEN_HEIGHT / 2.0f;	// Set Center Y
@@ -41,6 +55,9 @@ double inputDelay = 1.0;    // Delay of 1.0 seconds (500ms)
 
 bool polygonMode = false;
 
+unsigned long long frameCount = 0;
+UniformStats frameUniforms = {}; // uploads made by the last Scene::Render
+
 void checkOpenGLError(const std::string& functionName) {
 	GLenum error = glGetError();
 	if (error != GL_NO_ERROR) {
@@ -70,8 +87,79 @@ void checkOpenGLError(const std::string& functionName) {
 	}
 }
 
-int main() 
+// Test Hook : a weld tolerance of 0 must only merge vertices that are equal bit for bit (-0 and +0 aside)
+void checkExactWeld()
+{
+	std::vector<Vertex> vertices(5);
+	vertices[0].position = glm::vec3(1.0f, 2.0f, 3.0f);
+	vertices[1].position = glm::vec3(4.0f, 5.0f, 6.0f);      // all positive too, saturated to one cell before
+	vertices[2].position = glm::vec3(0.0f, 2.0f, 3.0f);      // a zero component, NaN before
+	vertices[3].position = glm::vec3(-0.0f, 2.0f, 3.0f);     // same as 2
+	vertices[4].position = glm::vec3(1.0f, 2.0f, 3.0f);      // same as 0
+	std::vector<unsigned int> indices = { 0, 1, 2, 3, 4 };
+
+	VertexWelder::Tolerance exact;
+	exact.position = exact.normal = exact.uv = 0.0f;
+	VertexWelder::Report report = VertexWelder::Weld(vertices, indices, exact);
+	if (report.after != 3 || indices[3] != indices[2] || indices[4] != indices[0] || indices[0] == indices[1])
+	{
+		std::cerr << "VertexWelder with a zero tolerance merged distinct vertices : " << report.before << " -> " << report.after << std::endl;
+		assert(report.after == 3);
+	}
+}
+
+// Test Hook : a block whose colors lie on one line must come back from BC1 and BC3 within a 5:6:5 step per channel,
+// and BC3 alpha within half a step of its 8-value ramp
+void checkBlockCompression()
 {
+	unsigned char block[64];
+	int minAlpha = 255, maxAlpha = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int t = i % 4;
+		block[i * 4 + 0] = static_cast<unsigned char>(30 + t * 60);
+		block[i * 4 + 1] = static_cast<unsigned char>(200 - t * 50);
+		block[i * 4 + 2] = static_cast<unsigned char>(60 + t * 20);
+		block[i * 4 + 3] = static_cast<unsigned char>(235 - t * 60 + (i / 4) * 5);
+		minAlpha = std::min(minAlpha, static_cast<int>(block[i * 4 + 3]));
+		maxAlpha = std::max(maxAlpha, static_cast<int>(block[i * 4 + 3]));
+	}
+
+	const BCEncoder::Format formats[2] = { BCEncoder::BC1, BCEncoder::BC3 };
+	for (int f = 0; f < 2; f++)
+	{
+		unsigned char encoded[16];
+		unsigned char decoded[64];
+		BCEncoder::EncodeBlock(block, formats[f], encoded);
+		BCEncoder::DecodeBlock(encoded, formats[f], decoded);
+
+		int colorError = 0, alphaError = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 3; c++)
+				colorError = std::max(colorError, std::abs(decoded[i * 4 + c] - block[i * 4 + c]));
+			int expectedAlpha = formats[f] == BCEncoder::BC3 ? block[i * 4 + 3] : 255;
+			alphaError = std::max(alphaError, std::abs(decoded[i * 4 + 3] - expectedAlpha));
+		}
+
+		int alphaBound = formats[f] == BCEncoder::BC3 ? (maxAlpha - minAlpha) / 14 + 1 : 0;
+		if (colorError > 8 || alphaError > alphaBound)
+		{
+			std::cerr << "BCEncoder round trip of BC" << formats[f] << " off by " << colorError << " (color), " << alphaError << " (alpha)" << std::endl;
+			assert(colorError <= 8 && alphaError <= alphaBound);
+		}
+	}
+}
+
+int main(int argc, char** argv) 
+{
+	// Offline mode : ToonShadeGL --bake [--srgb] [--default-texture <file>] <model or image>... writes the mesh and texture caches without a window
+	if (argc > 1 && std::string(argv[1]) == "--bake")
+		return bakeAssets(argc, argv);
+
+	checkExactWeld();
+	checkBlockCompression();
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
@@ -94,11 +182,13 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 	}
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_STENCIL_TEST);
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);   // Cull back faces (this is default, but ensure it's set)
-	glFrontFace(GL_CCW);   // Counter-clockwise is the front face (also default)
+	CompressedTexture::SetEnabled(CompressedTexture::Supported());
+
+	GLState::Get().Enable(GL_DEPTH_TEST);
+	GLState::Get().Enable(GL_STENCIL_TEST);
+	GLState::Get().Enable(GL_CULL_FACE);
+	GLState::Get().CullFace(GL_BACK);   // Cull back faces (this is default, but ensure it's set)
+	GLState::Get().FrontFace(GL_CCW);   // Counter-clockwise is the front face (also default)
 
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -112,8 +202,9 @@ int main()
 	// DATA: START
 	//Torus torus(0.5f, 1.0f, 16, 16);
 	//Cube lightCube;
-	Model mage("Resources/Model/Mage.glb", "mage_texture.png", false);
-	Model donut("Resources/Model/torus.fbx", "texture.png", false);
+	ModelStreamer modelStreamer;
+	std::shared_ptr<Model> mage = modelStreamer.Load("Resources/Model/Mage.glb", "mage_texture.png", false);
+	std::shared_ptr<Model> donut = modelStreamer.Load("Resources/Model/torus.fbx", "texture.png", false);
 	// DATA: END
 
 	// Light
@@ -133,14 +224,19 @@ int main()
 		glm::vec3(-14.3f,  -4.0f, -1.5f)
 	};
 
-	// Scene
-	Scene toonScene(lightManager);
+	// Scene : models live in the store, the scene only places them
+	ModelStore modelStore;
+	Scene toonScene(modelStore, lightManager);
 	toonScene.Add(mage, glm::vec3(0.0f, 0.0f, 0.0f));
 	toonScene.Add(donut, glm::vec3(0.0f, 0.0f, -5.0f));
 
-	Shader phongLightShader("Resources/Shaders/phong_light_tex.vert", "Resources/Shaders/phong_light_tex.frag");
-	Shader outlineShader("Resources/Shaders/outline.vert", "Resources/Shaders/outline.frag");
-	Shader defaultShader("Resources/Shaders/default.vert", "Resources/Shaders/default.frag");
+	// Programs build in the background, the scene draws as they become ready
+	ShaderManager shaderManager((GLADloadproc)glfwGetProcAddress);
+	// Toon edges are compiled in or out instead of branching per fragment, instances pick the variant (InstanceMaterial::toonMode)
+	Shader& toonShader = shaderManager.Load("Resources/Shaders/phong_light_tex.vert", "Resources/Shaders/phong_light_tex.frag", ShaderDefines().Set("TOON_EDGES", 1).Set("TOON_BANDS", 5));
+	Shader& plainShader = shaderManager.Load("Resources/Shaders/phong_light_tex.vert", "Resources/Shaders/phong_light_tex.frag", ShaderDefines().Set("TOON_EDGES", 0).Set("TOON_BANDS", 5));
+	Shader& outlineShader = shaderManager.Load("Resources/Shaders/outline.vert", "Resources/Shaders/outline.frag");
+	shaderManager.Load("Resources/Shaders/default.vert", "Resources/Shaders/default.frag");
 
 	while (!glfwWindowShouldClose(window))
 	{
@@ -150,6 +246,11 @@ int main()
 
 		processInput(window);
 
+		modelStreamer.Update(UPLOAD_BUDGET_MS);
+		shaderManager.Update();
+		GeometryArena::Get().Defragment();
+		toonScene.Prepare();
+
 		// GUI: START
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
@@ -158,19 +259,47 @@ int main()
 		//std::cout << "Frame Time: " << deltaTime << " seconds" << std::endl;
 
 		lightEditor.BuildGUI();
+
+		// Last frame's culling results, both passes
+		const MeshletStats& renderStats = toonScene.Stats();
+		ImGui::Begin("Render Stats");
+		ImGui::Text("Meshlets drawn : %u / %u", renderStats.drawn, renderStats.tested);
+		ImGui::Text("Triangles : %u in %u draws", renderStats.triangles, renderStats.draws);
+		ImGui::Text("Instanced placements : %u", renderStats.instances);
+		const RenderQueueStats& queueStats = toonScene.QueueStats();
+		ImGui::Text("Render queue : %u draws, %s (%u radix passes, %u moves)", queueStats.packets, queueStats.incremental ? "order kept" : "resorted", queueStats.radixPasses, queueStats.moves);
+		ImGui::Text("Uniform uploads : %llu issued, %llu skipped", frameUniforms.issued, frameUniforms.skipped);
+		ImGui::Text("Lights block uploads : %llu", lightManager.Uploads());
+		ImGui::Text("GL state calls : %llu issued, %llu skipped", GLState::Get().LastFrame().issued, GLState::Get().LastFrame().skipped);
+		GeometryArena::Stats arenaStats = GeometryArena::Get().GetStats();
+		ImGui::Text("Geometry arena : %.1f / %.1f MB, %.1f MB in holes", arenaStats.usedBytes / 1048576.0, arenaStats.capacityBytes / 1048576.0, arenaStats.holeBytes / 1048576.0);
+		ImGui::End();
 		// GUI: END
 
 		glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);  // Replace stencil value with reference value
+		GLState::Get().StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);  // Replace stencil value with reference value
 
 		// Positional
 		glm::mat4 proj = mainCamera.GetProjectionMatrix((float)SCREEN_WIDTH / SCREEN_HEIGHT);
 		glm::mat4 view = mainCamera.GetViewMatrix();
 
 		// Render
-		toonScene.Render(proj, view, mainCamera.Position, phongLightShader, outlineShader);
+		AllocationCounter::Reset();
+		UniformStats uniformsBefore = Shader::TotalStats();
+		toonScene.Render(proj, view, mainCamera.Position, toonShader, plainShader, outlineShader);
+		frameUniforms.issued = Shader::TotalStats().issued - uniformsBefore.issued;
+		frameUniforms.skipped = Shader::TotalStats().skipped - uniformsBefore.skipped;
+
+		// Test Hook : Scene rendering must not touch the heap once warmed up (counted on this thread, imports running on the pool are not)
+		std::size_t renderAllocations = AllocationCounter::Count();
+		if (AllocationCounter::Enabled() && frameCount > 0 && renderAllocations > 0)
+		{
+			std::cerr << "Scene::Render made " << renderAllocations << " heap allocations in frame " << frameCount << std::endl;
+			assert(renderAllocations == 0);
+		}
+		frameCount++;
 
 		ImGui::Render();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -181,13 +310,18 @@ int main()
 			std::cerr << "OpenGL Error: " << error << std::endl;
 		}
 
+		GLState::Get().EndFrame();
+
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
-	donut.Delete();
-	phongLightShader.Delete();
-	defaultShader.Delete();
+	modelStore.Clear();
+	toonScene.Delete();
+	lightManager.Delete();
+	GeometryArena::Get().Clear();
+	UploadRing::Get().Clear();
+	shaderManager.Delete();
 
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
@@ -283,3 +417,47 @@ void scrollCB(GLFWwindow* window, double xoffset, double yoffset)
 {
 	mainCamera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
+
+// Images get a .bctex beside them, models a .meshcache plus a .bctex per texture.
+// "--default-texture <file>" sets the "*0" fallback for the models after it, it's part of the mesh cache key.
+// "--srgb" bakes the following assets for gamma corrected models (sRGB formats, linear-space mips).
+int bakeAssets(int argc, char** argv)
+{
+	CompressedTexture::SetEnabled(true);
+
+	std::string defaultTexPath = "texture.png";
+	bool srgb = false;
+	int failures = 0;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string path = argv[i];
+		if (path == "--default-texture" && i + 1 < argc)
+		{
+			defaultTexPath = argv[++i];
+			continue;
+		}
+		if (path == "--srgb")
+		{
+			srgb = true;
+			continue;
+		}
+
+		std::string extension = path.substr(path.find_last_of('.') + 1);
+		for (unsigned int c = 0; c < extension.size(); c++)
+			extension[c] = static_cast<char>(tolower(extension[c]));
+
+		if (extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "tga" || extension == "bmp")
+		{
+			if (!CompressedTexture::Bake(path, srgb, &ThreadPool::Shared()))
+				failures++;
+		}
+		else
+		{
+			std::unique_ptr<ModelData> data = Model::Import(path, defaultTexPath, srgb);
+			std::cout << path << " : " << data->MeshCount() << " meshes, " << data->textures.size() << " textures, " << data->importMs << " ms" << std::endl;
+			if (data->MeshCount() == 0)
+				failures++;
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file (MapViewOfFile on Windows, mmap elsewhere)
+class MappedFile
+{
+public:
+	MappedFile() : data(nullptr), size(0), fileHandle(nullptr), mappingHandle(nullptr) {}
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+
+	bool IsOpen() const { return data != nullptr; }
+	const unsigned char* Data() const { return data; }
+	std::size_t Size() const { return size; }
+private:
+	const unsigned char* data;
+	std::size_t size;
+
+	void* fileHandle;
+	void* mappingHandle;
+};
+
+// Renames from over to, replacing an existing file in one step, so readers see either the old file or the new one.
+// For caches written next to their target first (MoveFileEx on Windows, rename elsewhere).
+bool MoveFileReplacing(const std::string& from, const std::string& to);
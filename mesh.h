@@ -6,24 +6,77 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <string>
 
 #include "shader.h"
+#include "asset_registry.h"
+#include "geometry_arena.h"
+#include "gl_state.h"
+#include "mesh_optimizer.h"
+#include "meshlet.h"
+#include "mesh_simplifier.h"
+#include "vertex_format.h"
+#include "vertex_welder.h"
 
-struct Vertex
+struct Texture
 {
-	glm::vec3 position;
-	glm::vec3 normal;
-	glm::vec2 uv;
+	GLuint ID;
+	std::string type;
+	std::string path;
+	std::uint64_t contentHash; // AssetRegistry key, 0 if not shared
+	std::size_t gpuBytes = 0;  // every mip level as uploaded
 };
 
-struct Texture
+// What a mesh keeps in system memory once its buffers are on the GPU
+enum class GeometryResidency : std::uint8_t
+{
+	Keep,       // full precision vertices and indices, for picking or physics
+	Drop,       // only what drawing needs : LOD ranges, meshlets and bounds
+	BoundsOnly  // LOD ranges and bounds, meshlet culling is given up for the smallest footprint
+};
+
+struct MemoryUsage
+{
+	std::size_t cpuBytes;
+	std::size_t gpuBytes;
+};
+
+// Pixels of an embedded texture that only Assimp held (data URI, raw texels), taken out while the aiScene was alive
+struct DecodedImage
+{
+	std::vector<unsigned char> pixels;
+	int width = 0;
+	int height = 0;
+	int components = 0;
+};
+
+// Texture a mesh refers to, before anything is loaded
+// Embedded textures ("*N") point at their encoded bytes inside the model file instead of a path on disk,
+// or carry their pixels when the file holds no such bytes.
+struct TextureRef
 {
-	GLuint ID;
 	std::string type;
 	std::string path;
+	std::uint64_t embeddedOffset = 0;
+	std::uint64_t embeddedSize = 0;
+	std::shared_ptr<const DecodedImage> decoded;  // embedded texture with no byte range in the file, decoded during import
+};
+
+// CPU-side result of importing one mesh, safe to build off the GL thread
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<TextureRef> textures;
+	std::vector<MeshLod> lods;  // index ranges, a single full range without MeshSteps_GenerateLods
+	std::vector<Meshlet> meshlets;  // every LOD's triangles in clusters, empty without MeshSteps_BuildMeshlets
+
+	VertexWelder::Report weldReport = {};    // filled by MeshSteps_WeldVertices
+	MeshOptimizer::Report cacheReport = {};  // filled by MeshSteps_OptimizeCache
 };
 
 
@@ -34,92 +87,362 @@ public:
 	std::vector<unsigned int> indices;
 	std::vector<Texture> textures;
 
-	GLuint VAO;
+	GeometryArena::BlockId geometry;  // vertices and indices inside the GeometryArena
+	unsigned int vertexCount;
+	unsigned int indexCount;  // level 0
+
+	std::vector<MeshLod> lods;
+	std::vector<Meshlet> meshlets;
+	glm::vec3 boundsMin, boundsMax;  // model space
+
+	VertexFormat format;
+	VertexDecode decode;
+	GLenum indexType;
+
+	std::uint64_t contentHash; // AssetRegistry key, 0 if not shared
+	bool sharedBuffers;        // geometry came from the AssetRegistry, another mesh uploaded it
 
-	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures)
+	// Covers everything that ends up on the GPU : packed bytes, layout and decode constants
+	static std::uint64_t Hash(const PackedGeometry& packed)
 	{
-		this->vertices = vertices;
-		this->indices =	 indices;
-		this->textures = textures;
+		std::uint64_t hash = AssetRegistry::Hash(packed.vertices, packed.vertexBytes);
+		hash = AssetRegistry::Hash(packed.indices, packed.indexBytes, hash);
+		hash = AssetRegistry::Hash(&packed.format, sizeof(packed.format), hash);
+		hash = AssetRegistry::Hash(&packed.decode.offset[0], sizeof(float) * 4, hash);
+		return AssetRegistry::Hash(&packed.decode.scale[0], sizeof(float) * 3, hash);
+	}
+
+	// Full precision upload, keeps the CPU copies
+	Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> textures, std::uint64_t contentHash = 0) : contentHash(contentHash), sharedBuffers(false)
+	{
+		this->vertices = std::move(vertices);
+		this->indices =	std::move(indices);
+		this->textures = std::move(textures);
 
-		setupMesh();
+		setupSamplerIds();
+		PackedMesh packed = VertexPacker::Pack(this->vertices.data(), static_cast<unsigned int>(this->vertices.size()), this->indices.data(), static_cast<unsigned int>(this->indices.size()), VertexFormat::Full());
+		setupMesh(packed.View(), std::vector<MeshLod>(), std::vector<Meshlet>());
 	}
 
-	void Draw(Shader& shader)
+	// Uploads vertices packed off the GL thread or mapped from the MeshCache (see Model::Import), no CPU copy is kept
+	// lods are ranges of packed's index buffer, empty means the whole buffer is level 0; meshlets may be empty
+	// deferUpload only reserves the arena block, UploadGeometry then fills it a chunk at a time (see Model::UploadStep)
+	Mesh(const PackedGeometry& packed, std::vector<Texture> textures, std::vector<MeshLod> lods, std::vector<Meshlet> meshlets, std::uint64_t contentHash = 0, bool deferUpload = false) : contentHash(contentHash), sharedBuffers(false)
 	{
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
+		this->textures = std::move(textures);
 
-		for (unsigned int i = 0; i < textures.size(); i++)
+		setupSamplerIds();
+		setupMesh(packed, std::move(lods), std::move(meshlets), deferUpload);
+	}
+
+	// Writes up to maxBytes more of packed's vertices, then indices, through ring (client memory without one).
+	// True once the whole block is written and registered for sharing, false while there is more or the ring is stalled.
+	bool UploadGeometry(const PackedGeometry& packed, std::size_t maxBytes, UploadRing* ring)
+	{
+		std::size_t total = vertexBytes + indexBytes;
+		if (uploadedBytes == total)
+			return true;
+
+		while (uploadedBytes < total && maxBytes > 0)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
+			bool vertexPart = uploadedBytes < vertexBytes;
+			std::size_t offset = vertexPart ? uploadedBytes : uploadedBytes - vertexBytes;
+			std::size_t bytes = std::min(maxBytes, (vertexPart ? vertexBytes : indexBytes) - offset);
+			const unsigned char* source = (vertexPart ? packed.vertices : packed.indices) + offset;
 
-			std::string number;
-			std::string name = textures[i].type;
+			bool written = vertexPart ? GeometryArena::Get().WriteVertices(geometry, offset, source, bytes, ring) : GeometryArena::Get().WriteIndices(geometry, offset, source, bytes, ring);
+			if (!written)
+				return false;
 
-			if (name == "diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (name == "specular")
-				number = std::to_string(specularNr++);
-			else if (name == "normal")
-				number = std::to_string(normalNr++); 
+			uploadedBytes += bytes;
+			maxBytes -= bytes;
+		}
+
+		if (uploadedBytes < total)
+			return false;
+
+		registerGeometry();
+		return true;
+	}
+
+	void Draw(const Shader& shader, unsigned int lod = 0) const
+	{
+		BindTextures(shader);
+		DrawBasic(lod);
+	}
+
+	void Draw(const Shader& shader, unsigned int lod, const MeshletCull& cull, MeshletStats& stats) const
+	{
+		BindTextures(shader);
+		DrawBasic(lod, cull, stats);
+	}
+
+	void DrawBasic(unsigned int lod = 0) const
+	{
+		const MeshLod& level = lods[lod];
+		const GeometryArena::Block& block = GeometryArena::Get().GetBlock(geometry);
+		std::size_t offset = static_cast<std::size_t>(block.firstIndex + level.indexOffset) * (indexType == GL_UNSIGNED_SHORT ? 2 : 4);
+
+		glVertexAttrib4fv(3, &decode.offset[0]);
+		glVertexAttrib3fv(4, &decode.scale[0]);
+
+		GLState::Get().BindVertexArray(GeometryArena::Get().VAO(block.pool));
+		glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, indexType, reinterpret_cast<const void*>(offset), block.baseVertex);
+	}
+
+	// Only the meshlets of this LOD that pass cull, neighbouring survivors are merged into one range
+	void DrawBasic(unsigned int lod, const MeshletCull& cull, MeshletStats& stats) const
+	{
+		unsigned int begin = lodMeshlets[lod];
+		unsigned int end = lodMeshlets[lod + 1];
+		if (begin == end)
+		{
+			DrawBasic(lod);
+			stats.triangles += lods[lod].indexCount / 3;
+			stats.draws++;
+			return;
+		}
+
+		const GeometryArena::Block& block = GeometryArena::Get().GetBlock(geometry);
+		std::size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+		GLsizei rangeCount = 0;
+		unsigned int rangeEnd = 0;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			const Meshlet& meshlet = meshlets[i];
+			stats.tested++;
+			if (!cull.Visible(meshlet))
+				continue;
 
-			shader.SetInt((name + number), i);
-			glBindTexture(GL_TEXTURE_2D, textures[i].ID);
+			stats.drawn++;
+			stats.triangles += meshlet.indexCount / 3;
+			if (rangeCount > 0 && rangeEnd == meshlet.indexOffset)
+			{
+				drawCounts[rangeCount - 1] += meshlet.indexCount;
+			}
+			else
+			{
+				drawCounts[rangeCount] = meshlet.indexCount;
+				drawOffsets[rangeCount] = reinterpret_cast<const void*>((block.firstIndex + meshlet.indexOffset) * indexSize);
+				drawBaseVertices[rangeCount] = block.baseVertex;
+				rangeCount++;
+			}
+			rangeEnd = meshlet.indexOffset + meshlet.indexCount;
 		}
 
-		DrawBasic();
+		if (rangeCount == 0)
+			return;
 
-		glActiveTexture(GL_TEXTURE0);
+		glVertexAttrib4fv(3, &decode.offset[0]);
+		glVertexAttrib3fv(4, &decode.scale[0]);
+
+		GLState::Get().BindVertexArray(GeometryArena::Get().VAO(block.pool));
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), indexType, drawOffsets.data(), rangeCount, drawBaseVertices.data());
+		stats.draws++;
+	}
+
+	// Same culling as DrawBasic, but the surviving ranges go to visit(firstIndex, indexCount) as absolute arena offsets
+	// instead of being drawn, for callers building indirect commands (see Scene::Render)
+	template <typename F>
+	void CollectRanges(unsigned int lod, const MeshletCull& cull, MeshletStats& stats, const F& visit) const
+	{
+		const GeometryArena::Block& block = GeometryArena::Get().GetBlock(geometry);
+		unsigned int begin = lodMeshlets[lod];
+		unsigned int end = lodMeshlets[lod + 1];
+		if (begin == end)
+		{
+			visit(block.firstIndex + lods[lod].indexOffset, lods[lod].indexCount);
+			stats.triangles += lods[lod].indexCount / 3;
+			return;
+		}
+
+		unsigned int rangeStart = 0;
+		unsigned int rangeEnd = 0;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			const Meshlet& meshlet = meshlets[i];
+			stats.tested++;
+			if (!cull.Visible(meshlet))
+				continue;
+
+			stats.drawn++;
+			stats.triangles += meshlet.indexCount / 3;
+			if (rangeEnd != rangeStart && rangeEnd == meshlet.indexOffset)
+			{
+				rangeEnd += meshlet.indexCount;
+				continue;
+			}
+
+			if (rangeEnd != rangeStart)
+				visit(block.firstIndex + rangeStart, rangeEnd - rangeStart);
+			rangeStart = meshlet.indexOffset;
+			rangeEnd = meshlet.indexOffset + meshlet.indexCount;
+		}
+		if (rangeEnd != rangeStart)
+			visit(block.firstIndex + rangeStart, rangeEnd - rangeStart);
+	}
+
+	// Upper bound on the ranges CollectRanges reports for any LOD
+	unsigned int MaxRanges() const
+	{
+		return static_cast<unsigned int>(std::max<std::size_t>(meshlets.size(), 1));
+	}
+
+	// Texture units and sampler uniforms, left bound for the following draws
+	void BindTextures(const Shader& shader) const
+	{
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			shader.SetInt(samplerIds[i], static_cast<int>(i));
+			GLState::Get().BindTexture(i, textures[i].ID);
+		}
+	}
+
+	// Coarsest level whose error stays within maxError (model units)
+	unsigned int SelectLod(float maxError) const
+	{
+		unsigned int lod = 0;
+		while (lod + 1 < lods.size() && lods[lod + 1].error <= maxError)
+			lod++;
+		return lod;
+	}
+
+	// Frees system memory the residency doesn't ask for, the GPU side is untouched
+	void ApplyResidency(GeometryResidency residency)
+	{
+		if (residency != GeometryResidency::Keep)
+		{
+			std::vector<Vertex>().swap(vertices);
+			std::vector<unsigned int>().swap(indices);
+		}
+
+		if (residency == GeometryResidency::BoundsOnly)
+		{
+			std::vector<Meshlet>().swap(meshlets);
+			std::fill(lodMeshlets.begin(), lodMeshlets.end(), 0u);
+			std::vector<GLsizei>().swap(drawCounts);
+			std::vector<const void*>().swap(drawOffsets);
+			std::vector<GLint>().swap(drawBaseVertices);
+		}
 	}
 
-	void DrawBasic() {
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	// CPU : every container this mesh holds. GPU : its vertex and index bytes in the arena, counted even when shared (see sharedBuffers).
+	MemoryUsage Memory() const
+	{
+		MemoryUsage usage;
+		usage.cpuBytes = vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int)
+			+ lods.capacity() * sizeof(MeshLod) + meshlets.capacity() * sizeof(Meshlet)
+			+ lodMeshlets.capacity() * sizeof(unsigned int) + drawCounts.capacity() * sizeof(GLsizei) + drawOffsets.capacity() * sizeof(const void*)
+			+ drawBaseVertices.capacity() * sizeof(GLint);
+		usage.gpuBytes = vertexBytes + indexBytes;
+		return usage;
 	}
 
 	void Delete() const
 	{
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteBuffers(1, &EBO);
+		MeshBuffers buffers = { geometry, vertexCount, indexCount, format, decode, indexType, vertexBytes, indexBytes };
+		AssetRegistry::Get().ReleaseMesh(contentHash, buffers);
 	}
 private:
-	GLuint VBO, EBO;
+	std::size_t vertexBytes, indexBytes;
+	std::size_t uploadedBytes;  // written into the arena block so far, the block is only shared once all are
+
+	// Sampler uniform per texture ("diffuse1", "specular1", ...), hashed once so binding never touches a string
+	std::vector<UniformId> samplerIds;
 
-	void setupMesh()
+	// First meshlet of each LOD (one extra entry closing the last), and the glMultiDrawElementsBaseVertex arguments,
+	// sized for every meshlet up front so culled draws don't allocate
+	std::vector<unsigned int> lodMeshlets;
+	mutable std::vector<GLsizei> drawCounts;
+	mutable std::vector<const void*> drawOffsets;
+	mutable std::vector<GLint> drawBaseVertices;
+
+	void setupSamplerIds()
 	{
-		GLint bufferSize;
+		unsigned int diffuseNr = 1;
+		unsigned int specularNr = 1;
+		unsigned int normalNr = 1;
 
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		samplerIds.clear();
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			std::string number;
+			std::string name = textures[i].type;
 
-		glBindVertexArray(VAO);
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+			if (name == "diffuse")
+				number = std::to_string(diffuseNr++);
+			else if (name == "specular")
+				number = std::to_string(specularNr++);
+			else if (name == "normal")
+				number = std::to_string(normalNr++);
 
-		glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &bufferSize);
-		std::cout << "Size of the VBO data uploaded: " << bufferSize << " bytes" << std::endl;
+			UniformId id = { Shader::Hash((name + number).c_str()) };
+			samplerIds.push_back(id);
+		}
+	}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+	void setupMesh(const PackedGeometry& packed, std::vector<MeshLod> lods, std::vector<Meshlet> meshlets, bool deferUpload = false)
+	{
+		if (lods.empty())
+		{
+			MeshLod full = { 0, packed.indexCount, 0.0f };
+			lods.push_back(full);
+		}
+		this->lods = std::move(lods);
+		this->meshlets = std::move(meshlets);
+		this->boundsMin = packed.boundsMin;
 
-		glGetBufferParameteriv(GL_ELEMENT_ARRAY_BUFFER, GL_BUFFER_SIZE, &bufferSize);
-		std::cout << "Size of the EBO data uploaded: " << bufferSize << " bytes" << std::endl;
+		// Meshlets are built per LOD in index order, so each level's are a contiguous run
+		lodMeshlets.resize(this->lods.size() + 1);
+		unsigned int cursor = 0;
+		for (unsigned int l = 0; l < this->lods.size(); l++)
+		{
+			while (cursor < this->meshlets.size() && this->meshlets[cursor].indexOffset < this->lods[l].indexOffset)
+				cursor++;
+			lodMeshlets[l] = cursor;
+		}
+		lodMeshlets[this->lods.size()] = static_cast<unsigned int>(this->meshlets.size());
 
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0); // Positions
+		drawCounts.resize(this->meshlets.size());
+		drawOffsets.resize(this->meshlets.size());
+		drawBaseVertices.resize(this->meshlets.size());
+		this->boundsMax = packed.boundsMax;
 
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, normal));
+		this->vertexCount = packed.vertexCount;
+		this->indexCount = this->lods[0].indexCount;
+		this->format = packed.format;
+		this->decode = packed.decode;
+		this->indexType = packed.indexType;
+		this->vertexBytes = packed.vertexBytes;
+		this->indexBytes = packed.indexBytes;
 
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, uv));
+		// Same content already on the GPU : share its block instead of uploading again
+		MeshBuffers shared;
+		if (AssetRegistry::Get().AcquireMesh(contentHash, shared))
+		{
+			geometry = shared.geometry;
+			sharedBuffers = true;
+			uploadedBytes = vertexBytes + indexBytes;
+			return;
+		}
 
-		glBindVertexArray(0);
+		if (deferUpload)
+		{
+			geometry = GeometryArena::Get().Reserve(format, indexType, vertexCount, packed.indexCount);
+			uploadedBytes = 0;
+			if (vertexBytes + indexBytes == 0)
+				registerGeometry();
+			return;
+		}
+
+		geometry = GeometryArena::Get().Allocate(packed);
+		uploadedBytes = vertexBytes + indexBytes;
+		registerGeometry();
 	}
-};
 
+	void registerGeometry()
+	{
+		MeshBuffers buffers = { geometry, vertexCount, indexCount, format, decode, indexType, vertexBytes, indexBytes };
+		AssetRegistry::Get().RegisterMesh(contentHash, buffers);
+	}
+};
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "mesh.h"
+
+// Versioned on-disk cache of post-processed model geometry ("<model>.meshcache")
+// Layout : Header | Entry per mesh | texture records (type, path, embedded range), LOD and meshlet records | 16-byte aligned vertex and index blocks,
+// packed (the VertexFormat's bytes, uploaded as they are) then full precision (only read for GeometryResidency::Keep)
+// On a hit the blocks are read straight out of the mapping, no intermediate vectors are built.
+class MeshCache
+{
+public:
+	static const std::uint32_t VERSION = 6;
+
+	struct MeshView
+	{
+		const Vertex* vertices;
+		unsigned int vertexCount;
+		const unsigned int* indices;
+		unsigned int indexCount;  // every LOD
+		std::vector<TextureRef> textures;
+		std::vector<MeshLod> lods;
+		std::vector<Meshlet> meshlets;
+		PackedGeometry packed;      // points into the mapping
+		std::uint64_t contentHash;  // Mesh::Hash of packed
+	};
+
+	// Everything that changes the imported result : source bytes, Assimp flags, our MeshSteps (and weld grid), the packed VertexFormat and the "*0" texture fallback
+	static std::uint64_t Key(const MappedFile& source, unsigned int importFlags, unsigned int meshSteps, const VertexWelder::Tolerance& weldTolerance, const VertexFormat& format, const std::string& defaultTexturePath)
+	{
+		std::uint64_t key = AssetRegistry::Hash(source.Data(), source.Size());
+		key = AssetRegistry::Hash(&importFlags, sizeof(importFlags), key);
+		key = AssetRegistry::Hash(&meshSteps, sizeof(meshSteps), key);
+		if (meshSteps & MeshSteps_WeldVertices)
+			key = AssetRegistry::Hash(&weldTolerance, sizeof(weldTolerance), key);
+		key = AssetRegistry::Hash(&format, sizeof(format), key);
+		key = AssetRegistry::Hash(defaultTexturePath.data(), defaultTexturePath.size(), key);
+		return key;
+	}
+
+	bool Open(const std::string& cachePath, std::uint64_t key)
+	{
+		Close();
+
+		if (!file.Open(cachePath))
+			return false;
+
+		const unsigned char* base = file.Data();
+		std::size_t size = file.Size();
+
+		if (size < sizeof(Header))
+			return fail();
+
+		Header header;
+		std::memcpy(&header, base, sizeof(Header));
+		if (std::memcmp(header.magic, "TSMC", 4) != 0 || header.version != VERSION || header.vertexSize != sizeof(Vertex) || header.key != key)
+			return fail();
+
+		std::size_t entriesEnd = sizeof(Header) + static_cast<std::size_t>(header.meshCount) * sizeof(Entry);
+		if (entriesEnd > size)
+			return fail();
+
+		for (unsigned int i = 0; i < header.meshCount; i++)
+		{
+			Entry entry;
+			std::memcpy(&entry, base + sizeof(Header) + i * sizeof(Entry), sizeof(Entry));
+
+			std::uint64_t vertexBytes = static_cast<std::uint64_t>(entry.vertexCount) * sizeof(Vertex);
+			std::uint64_t indexBytes = static_cast<std::uint64_t>(entry.indexCount) * sizeof(unsigned int);
+			if (entry.vertexOffset + vertexBytes > size || entry.indexOffset + indexBytes > size)
+				return fail();
+
+			std::uint64_t packedVertexBytes = static_cast<std::uint64_t>(entry.vertexCount) * entry.format.Stride();
+			std::uint64_t packedIndexBytes = static_cast<std::uint64_t>(entry.indexCount) * (entry.indexType == GL_UNSIGNED_SHORT ? 2 : 4);
+			if ((entry.indexType != GL_UNSIGNED_SHORT && entry.indexType != GL_UNSIGNED_INT) || entry.packedVertexOffset + packedVertexBytes > size || entry.packedIndexOffset + packedIndexBytes > size)
+				return fail();
+
+			MeshView view;
+			view.vertices = reinterpret_cast<const Vertex*>(base + entry.vertexOffset);
+			view.vertexCount = entry.vertexCount;
+			view.indices = reinterpret_cast<const unsigned int*>(base + entry.indexOffset);
+			view.indexCount = entry.indexCount;
+
+			view.packed.format = entry.format;
+			view.packed.decode = entry.decode;
+			view.packed.indexType = entry.indexType;
+			view.packed.vertexCount = entry.vertexCount;
+			view.packed.indexCount = entry.indexCount;
+			view.packed.boundsMin = entry.boundsMin;
+			view.packed.boundsMax = entry.boundsMax;
+			view.packed.vertices = base + entry.packedVertexOffset;
+			view.packed.vertexBytes = static_cast<std::size_t>(packedVertexBytes);
+			view.packed.indices = base + entry.packedIndexOffset;
+			view.packed.indexBytes = static_cast<std::size_t>(packedIndexBytes);
+			view.contentHash = entry.contentHash;
+
+			std::size_t cursor = static_cast<std::size_t>(entry.textureOffset);
+			for (unsigned int t = 0; t < entry.textureCount; t++)
+			{
+				TextureRef ref;
+				if (!readString(cursor, ref.type) || !readString(cursor, ref.path) || !readValue(cursor, ref.embeddedOffset) || !readValue(cursor, ref.embeddedSize))
+					return fail();
+				view.textures.push_back(ref);
+			}
+
+			view.lods.resize(entry.lodCount);
+			for (unsigned int l = 0; l < entry.lodCount; l++)
+			{
+				MeshLod& lod = view.lods[l];
+				if (!readValue(cursor, lod) || static_cast<std::uint64_t>(lod.indexOffset) + lod.indexCount > entry.indexCount)
+					return fail();
+			}
+			if (view.lods.empty())
+				return fail();
+
+			view.meshlets.resize(entry.meshletCount);
+			for (unsigned int m = 0; m < entry.meshletCount; m++)
+			{
+				Meshlet& meshlet = view.meshlets[m];
+				if (!readValue(cursor, meshlet) || static_cast<std::uint64_t>(meshlet.indexOffset) + meshlet.indexCount > entry.indexCount)
+					return fail();
+			}
+
+			meshes.push_back(view);
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+		meshes.clear();
+		file.Close();
+	}
+
+	const std::vector<MeshView>& Meshes() const
+	{
+		return meshes;
+	}
+
+	// packedMeshes and contentHashes run parallel to sourceMeshes (see Model::Import)
+	static bool Write(const std::string& cachePath, std::uint64_t key, const std::vector<MeshData>& sourceMeshes, const std::vector<PackedMesh>& packedMeshes, const std::vector<std::uint64_t>& contentHashes)
+	{
+		std::vector<Entry> entries(sourceMeshes.size());
+		std::vector<char> strings;
+
+		std::uint64_t cursor = sizeof(Header) + entries.size() * sizeof(Entry);
+		for (unsigned int i = 0; i < sourceMeshes.size(); i++)
+		{
+			const MeshData& mesh = sourceMeshes[i];
+			entries[i].textureOffset = cursor + strings.size();
+			entries[i].textureCount = static_cast<std::uint32_t>(mesh.textures.size());
+			for (unsigned int t = 0; t < mesh.textures.size(); t++)
+			{
+				appendString(strings, mesh.textures[t].type);
+				appendString(strings, mesh.textures[t].path);
+				appendValue(strings, mesh.textures[t].embeddedOffset);
+				appendValue(strings, mesh.textures[t].embeddedSize);
+			}
+
+			entries[i].lodCount = static_cast<std::uint32_t>(mesh.lods.size());
+			for (unsigned int l = 0; l < mesh.lods.size(); l++)
+				appendValue(strings, mesh.lods[l]);
+
+			entries[i].meshletCount = static_cast<std::uint32_t>(mesh.meshlets.size());
+			for (unsigned int m = 0; m < mesh.meshlets.size(); m++)
+				appendValue(strings, mesh.meshlets[m]);
+		}
+
+		cursor = align(cursor + strings.size());
+		for (unsigned int i = 0; i < sourceMeshes.size(); i++)
+		{
+			const MeshData& mesh = sourceMeshes[i];
+			const PackedMesh& packed = packedMeshes[i];
+			entries[i].vertexCount = static_cast<std::uint32_t>(mesh.vertices.size());
+			entries[i].indexCount = static_cast<std::uint32_t>(mesh.indices.size());
+			entries[i].indexType = packed.indexType;
+			entries[i].format = packed.format;
+			entries[i].decode = packed.decode;
+			entries[i].boundsMin = packed.boundsMin;
+			entries[i].boundsMax = packed.boundsMax;
+			entries[i].contentHash = contentHashes[i];
+
+			entries[i].packedVertexOffset = cursor;
+			cursor = align(cursor + packed.vertices.size());
+			entries[i].packedIndexOffset = cursor;
+			cursor = align(cursor + packed.indices.size());
+
+			entries[i].vertexOffset = cursor;
+			cursor = align(cursor + mesh.vertices.size() * sizeof(Vertex));
+			entries[i].indexOffset = cursor;
+			cursor = align(cursor + mesh.indices.size() * sizeof(unsigned int));
+		}
+
+		Header header;
+		std::memcpy(header.magic, "TSMC", 4);
+		header.version = VERSION;
+		header.vertexSize = sizeof(Vertex);
+		header.meshCount = static_cast<std::uint32_t>(sourceMeshes.size());
+		header.key = key;
+
+		// Written next to the cache and moved over it once complete, a crash or a failed write never leaves a torn cache behind
+		std::string tempPath = cachePath + ".tmp";
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		if (!entries.empty())
+			out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+		if (!strings.empty())
+			out.write(strings.data(), strings.size());
+
+		for (unsigned int i = 0; i < sourceMeshes.size(); i++)
+		{
+			const MeshData& mesh = sourceMeshes[i];
+			const PackedMesh& packed = packedMeshes[i];
+			pad(out, entries[i].packedVertexOffset);
+			out.write(reinterpret_cast<const char*>(packed.vertices.data()), packed.vertices.size());
+			pad(out, entries[i].packedIndexOffset);
+			out.write(reinterpret_cast<const char*>(packed.indices.data()), packed.indices.size());
+			pad(out, entries[i].vertexOffset);
+			out.write(reinterpret_cast<const char*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vertex));
+			pad(out, entries[i].indexOffset);
+			out.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(unsigned int));
+		}
+
+		out.close();
+		if (!out || !MoveFileReplacing(tempPath, cachePath))
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+private:
+	struct Header
+	{
+		char magic[4];
+		std::uint32_t version;
+		std::uint32_t vertexSize;
+		std::uint32_t meshCount;
+		std::uint64_t key;
+	};
+
+	struct Entry
+	{
+		std::uint32_t vertexCount;
+		std::uint32_t indexCount;
+		std::uint32_t textureCount;
+		std::uint32_t lodCount;
+		std::uint32_t meshletCount;
+		std::uint32_t indexType;  // of the packed indices
+		std::uint64_t textureOffset;
+		std::uint64_t vertexOffset;
+		std::uint64_t indexOffset;
+		std::uint64_t packedVertexOffset;
+		std::uint64_t packedIndexOffset;
+		std::uint64_t contentHash;
+		VertexDecode decode;
+		glm::vec3 boundsMin, boundsMax;
+		VertexFormat format;
+	};
+
+	MappedFile file;
+	std::vector<MeshView> meshes;
+
+	bool fail()
+	{
+		Close();
+		return false;
+	}
+
+	bool readString(std::size_t& cursor, std::string& value) const
+	{
+		std::uint32_t length;
+		if (cursor + sizeof(length) > file.Size())
+			return false;
+		std::memcpy(&length, file.Data() + cursor, sizeof(length));
+		cursor += sizeof(length);
+
+		if (cursor + length > file.Size())
+			return false;
+		value.assign(reinterpret_cast<const char*>(file.Data() + cursor), length);
+		cursor += length;
+		return true;
+	}
+
+	template <typename T>
+	bool readValue(std::size_t& cursor, T& value) const
+	{
+		if (cursor + sizeof(value) > file.Size())
+			return false;
+		std::memcpy(&value, file.Data() + cursor, sizeof(value));
+		cursor += sizeof(value);
+		return true;
+	}
+
+	template <typename T>
+	static void appendValue(std::vector<char>& blob, const T& value)
+	{
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		blob.insert(blob.end(), bytes, bytes + sizeof(value));
+	}
+
+	static void appendString(std::vector<char>& blob, const std::string& value)
+	{
+		std::uint32_t length = static_cast<std::uint32_t>(value.size());
+		const char* lengthBytes = reinterpret_cast<const char*>(&length);
+		blob.insert(blob.end(), lengthBytes, lengthBytes + sizeof(length));
+		blob.insert(blob.end(), value.begin(), value.end());
+	}
+
+	static std::uint64_t align(std::uint64_t offset)
+	{
+		return (offset + 15) & ~static_cast<std::uint64_t>(15);
+	}
+
+	static void pad(std::ofstream& out, std::uint64_t offset)
+	{
+		while (static_cast<std::uint64_t>(out.tellp()) < offset)
+			out.put(0);
+	}
+};
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_simplifier.h"
+#include "vertex_format.h"
+
+// Post-import steps run on every mesh after Assimp, stored in the MeshCache key like aiPostProcessSteps
+enum MeshSteps : unsigned int
+{
+	MeshSteps_None = 0,
+	MeshSteps_OptimizeCache = 1 << 0,  // vertex cache order, overdraw clusters, fetch order
+	MeshSteps_GenerateLods = 1 << 1,   // simplified levels appended to the index buffer (see MeshSimplifier)
+	MeshSteps_BuildMeshlets = 1 << 2,  // culling clusters over every level (see MeshletBuilder)
+	MeshSteps_WeldVertices = 1 << 3,   // merges duplicated corners before everything else (see VertexWelder)
+
+	MeshSteps_Default = MeshSteps_WeldVertices | MeshSteps_OptimizeCache | MeshSteps_GenerateLods | MeshSteps_BuildMeshlets
+};
+
+// Triangle and vertex reordering for the post-transform cache, overdraw and vertex fetch
+// Only the order changes : the same triangles are drawn with the same winding.
+class MeshOptimizer
+{
+public:
+	// FIFO of this size stands in for the GPU's post-transform cache when measuring
+	static const unsigned int SIMULATED_CACHE_SIZE = 16;
+
+	// ACMR : transformed vertices per triangle (0.5 is ideal on a regular grid, 3 is worst)
+	// ATVR : transformed vertices per vertex (1 is ideal)
+	struct CacheStats
+	{
+		float acmr;
+		float atvr;
+	};
+
+	struct Report
+	{
+		CacheStats before;
+		CacheStats after;
+	};
+
+	// Runs the three passes in order, indices and vertices are rewritten in place
+	static Report Optimize(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		std::vector<MeshLod> lods(1);
+		lods[0].indexOffset = 0;
+		lods[0].indexCount = static_cast<unsigned int>(indices.size());
+		lods[0].error = 0.0f;
+		return Optimize(vertices, indices, lods);
+	}
+
+	// Same with one index range per LOD : triangles are reordered within each range, the shared vertices
+	// are renumbered once in first-use order (level 0 first). The report covers level 0.
+	static Report Optimize(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, const std::vector<MeshLod>& lods)
+	{
+		unsigned int vertexCount = static_cast<unsigned int>(vertices.size());
+
+		Report report;
+		report.before = SimulateCache(indices.data(), lods[0].indexCount, vertexCount);
+
+		std::vector<unsigned int> range;
+		for (unsigned int i = 0; i < lods.size(); i++)
+		{
+			std::vector<unsigned int>::iterator begin = indices.begin() + lods[i].indexOffset;
+			range.assign(begin, begin + lods[i].indexCount);
+
+			OptimizeVertexCache(range, vertexCount);
+			OptimizeOverdraw(range, vertices);
+
+			std::copy(range.begin(), range.end(), begin);
+		}
+		OptimizeVertexFetch(vertices, indices);
+
+		report.after = SimulateCache(indices.data(), lods[0].indexCount, static_cast<unsigned int>(vertices.size()));
+		return report;
+	}
+
+	static CacheStats SimulateCache(const unsigned int* indices, unsigned int indexCount, unsigned int vertexCount)
+	{
+		CacheStats stats = { 0.0f, 0.0f };
+		if (indexCount == 0 || vertexCount == 0)
+			return stats;
+
+		// Timestamp FIFO : a vertex is cached while fewer than SIMULATED_CACHE_SIZE misses happened since it was loaded
+		std::vector<unsigned int> loadedAt(vertexCount, 0);
+		unsigned int misses = 0;
+		for (unsigned int i = 0; i < indexCount; i++)
+		{
+			unsigned int& stamp = loadedAt[indices[i]];
+			if (stamp == 0 || misses - stamp >= SIMULATED_CACHE_SIZE)
+			{
+				misses++;
+				stamp = misses;
+			}
+		}
+
+		stats.acmr = static_cast<float>(misses) / (indexCount / 3);
+		stats.atvr = static_cast<float>(misses) / vertexCount;
+		return stats;
+	}
+
+	// Forsyth's linear-speed vertex cache optimisation : greedily emits the best scoring triangle,
+	// scoring vertices by their position in a simulated LRU cache and how many triangles still use them
+	static void OptimizeVertexCache(std::vector<unsigned int>& indices, unsigned int vertexCount)
+	{
+		unsigned int triangleCount = static_cast<unsigned int>(indices.size() / 3);
+		if (triangleCount == 0)
+			return;
+
+		const ScoreTables& tables = scoreTables();
+
+		// Triangles per vertex (CSR), the live part of each list shrinks as triangles are emitted
+		std::vector<unsigned int> valence(vertexCount, 0);
+		for (unsigned int i = 0; i < indices.size(); i++)
+			valence[indices[i]]++;
+
+		std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+
+		std::vector<unsigned int> adjacency(indices.size());
+		std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for (unsigned int t = 0; t < triangleCount; t++)
+			for (unsigned int k = 0; k < 3; k++)
+				adjacency[fill[indices[t * 3 + k]]++] = t;
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (unsigned int v = 0; v < vertexCount; v++)
+			vertexScore[v] = tables.Score(-1, valence[v]);
+
+		std::vector<bool> emitted(triangleCount, false);
+
+		std::vector<unsigned int> cache, nextCache;
+		cache.reserve(CACHE_SIZE + 3);
+		nextCache.reserve(CACHE_SIZE + 3);
+
+		std::vector<unsigned int> result(indices.size());
+		unsigned int scanCursor = 0;
+		int best = -1;
+
+		for (unsigned int written = 0; written < triangleCount; written++)
+		{
+			// Nothing adjacent to the cache : take the next triangle in input order
+			if (best < 0)
+			{
+				while (emitted[scanCursor])
+					scanCursor++;
+				best = static_cast<int>(scanCursor);
+			}
+
+			unsigned int triangle = static_cast<unsigned int>(best);
+			emitted[triangle] = true;
+
+			// New LRU order : this triangle's vertices first, then what was cached before
+			nextCache.clear();
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[triangle * 3 + k];
+				result[written * 3 + k] = v;
+				nextCache.push_back(v);
+
+				unsigned int* begin = &adjacency[adjacencyStart[v]];
+				unsigned int* end = begin + valence[v];
+				*std::find(begin, end, triangle) = *(end - 1);
+				valence[v]--;
+			}
+			for (unsigned int i = 0; i < cache.size(); i++)
+			{
+				unsigned int v = cache[i];
+				if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+					nextCache.push_back(v);
+			}
+
+			// Vertices pushed out of the cache, then everything still in it, get rescored with their triangles
+			for (unsigned int i = 0; i < nextCache.size(); i++)
+			{
+				unsigned int v = nextCache[i];
+				cachePosition[v] = i < CACHE_SIZE ? static_cast<int>(i) : -1;
+				vertexScore[v] = tables.Score(cachePosition[v], valence[v]);
+			}
+
+			best = -1;
+			float bestScore = -1.0f;
+			for (unsigned int i = 0; i < nextCache.size(); i++)
+			{
+				unsigned int v = nextCache[i];
+				for (unsigned int a = 0; a < valence[v]; a++)
+				{
+					unsigned int t = adjacency[adjacencyStart[v] + a];
+					float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+					if (score > bestScore)
+					{
+						bestScore = score;
+						best = static_cast<int>(t);
+					}
+				}
+			}
+
+			if (nextCache.size() > CACHE_SIZE)
+				nextCache.resize(CACHE_SIZE);
+			cache.swap(nextCache);
+		}
+
+		indices.swap(result);
+	}
+
+	// Splits the cache-ordered triangles into clusters where the cache starts over, and draws the clusters
+	// facing away from the mesh center first, so the outer surface tends to land before what it hides
+	static void OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices)
+	{
+		unsigned int triangleCount = static_cast<unsigned int>(indices.size() / 3);
+		if (triangleCount == 0)
+			return;
+
+		// Hard boundaries : triangles whose 3 vertices all miss the simulated cache
+		std::vector<unsigned int> clusterStart;
+		std::vector<unsigned int> loadedAt(vertices.size(), 0);
+		unsigned int misses = 0;
+		for (unsigned int t = 0; t < triangleCount; t++)
+		{
+			unsigned int triangleMisses = 0;
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				unsigned int& stamp = loadedAt[indices[t * 3 + k]];
+				if (stamp == 0 || misses - stamp >= SIMULATED_CACHE_SIZE)
+				{
+					misses++;
+					stamp = misses;
+					triangleMisses++;
+				}
+			}
+			if (t == 0 || triangleMisses == 3)
+				clusterStart.push_back(t);
+		}
+		clusterStart.push_back(triangleCount);
+
+		unsigned int clusterCount = static_cast<unsigned int>(clusterStart.size() - 1);
+		if (clusterCount < 2)
+			return;
+
+		// Area weighted centroid and normal per cluster
+		std::vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.0f));
+		std::vector<glm::vec3> clusterNormal(clusterCount, glm::vec3(0.0f));
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+
+		for (unsigned int c = 0; c < clusterCount; c++)
+		{
+			float clusterArea = 0.0f;
+			for (unsigned int t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+			{
+				const glm::vec3& a = vertices[indices[t * 3]].position;
+				const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+				const glm::vec3& d = vertices[indices[t * 3 + 2]].position;
+
+				glm::vec3 normal = glm::cross(b - a, d - a);
+				float area = glm::length(normal);
+				glm::vec3 center = (a + b + d) / 3.0f;
+
+				clusterCentroid[c] += center * area;
+				clusterNormal[c] += normal;
+				clusterArea += area;
+			}
+
+			meshCentroid += clusterCentroid[c];
+			meshArea += clusterArea;
+			clusterCentroid[c] = clusterArea > 0.0f ? clusterCentroid[c] / clusterArea : clusterCentroid[c];
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+
+		std::vector<float> sortKey(clusterCount);
+		std::vector<unsigned int> order(clusterCount);
+		for (unsigned int c = 0; c < clusterCount; c++)
+		{
+			float length = glm::length(clusterNormal[c]);
+			sortKey[c] = length > 0.0f ? glm::dot(clusterCentroid[c] - meshCentroid, clusterNormal[c] / length) : 0.0f;
+			order[c] = c;
+		}
+		std::stable_sort(order.begin(), order.end(), [&sortKey](unsigned int a, unsigned int b) { return sortKey[a] > sortKey[b]; });
+
+		std::vector<unsigned int> result;
+		result.reserve(indices.size());
+		for (unsigned int i = 0; i < clusterCount; i++)
+		{
+			unsigned int c = order[i];
+			result.insert(result.end(), indices.begin() + clusterStart[c] * 3, indices.begin() + clusterStart[c + 1] * 3);
+		}
+		indices.swap(result);
+	}
+
+	// Renumbers vertices in first-use order so fetches walk the buffer forwards, unreferenced vertices are dropped
+	static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		const unsigned int unused = 0xFFFFFFFFu;
+		std::vector<unsigned int> remap(vertices.size(), unused);
+
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+		for (unsigned int i = 0; i < indices.size(); i++)
+		{
+			unsigned int& target = remap[indices[i]];
+			if (target == unused)
+			{
+				target = static_cast<unsigned int>(result.size());
+				result.push_back(vertices[indices[i]]);
+			}
+			indices[i] = target;
+		}
+		vertices.swap(result);
+	}
+private:
+	static const unsigned int CACHE_SIZE = 32;    // LRU size Forsyth's scores are tuned for
+	static const unsigned int MAX_VALENCE = 64;   // valence scores past this are all but zero
+
+	struct ScoreTables
+	{
+		float cache[CACHE_SIZE];
+		float valence[MAX_VALENCE];
+
+		ScoreTables()
+		{
+			for (unsigned int i = 0; i < CACHE_SIZE; i++)
+			{
+				// The last triangle's vertices get a fixed score so it isn't simply repeated
+				if (i < 3)
+					cache[i] = 0.75f;
+				else
+					cache[i] = std::pow(1.0f - static_cast<float>(i - 3) / (CACHE_SIZE - 3), 1.5f);
+			}
+
+			valence[0] = 0.0f;
+			for (unsigned int i = 1; i < MAX_VALENCE; i++)
+				valence[i] = 2.0f * std::pow(static_cast<float>(i), -0.5f);
+		}
+
+		// Vertices with no triangles left score -1 so they never pull a triangle up
+		float Score(int cachePosition, unsigned int remaining) const
+		{
+			if (remaining == 0)
+				return -1.0f;
+
+			float score = cachePosition >= 0 ? cache[cachePosition] : 0.0f;
+			return score + valence[std::min(remaining, MAX_VALENCE - 1)];
+		}
+	};
+
+	static const ScoreTables& scoreTables()
+	{
+		static ScoreTables tables;
+		return tables;
+	}
+};
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "vertex_format.h"
+
+// One level of detail : a range of the mesh's index buffer, every level shares the same vertices
+struct MeshLod
+{
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	float error;  // geometric deviation from level 0 in model units
+};
+
+// Quadric error edge collapse (Garland-Heckbert), collapsing a vertex onto a neighbour so no vertices are created
+// Vertices sharing a position are handled as one; when their normals or UVs differ (UV seam, hard edge) they are locked,
+// as are open borders, and collapses that flip or sharply turn a face are rejected to keep the silhouette.
+class MeshSimplifier
+{
+public:
+	static const unsigned int MAX_LODS = 4;
+
+	// Appends each coarser level to indices (about half the triangles of the previous one)
+	// and returns the ranges, level 0 being the original indices
+	static std::vector<MeshLod> BuildChain(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		std::vector<MeshLod> lods(1);
+		lods[0].indexOffset = 0;
+		lods[0].indexCount = static_cast<unsigned int>(indices.size());
+		lods[0].error = 0.0f;
+
+		std::vector<unsigned int> current = indices;
+		while (lods.size() < MAX_LODS && current.size() >= MIN_TRIANGLES * 3 * 2)
+		{
+			float error = 0.0f;
+			std::vector<unsigned int> next = Simplify(vertices, current, current.size() / 6 * 3, error);
+
+			// Stuck on locked vertices, a level this close to the last isn't worth its memory
+			if (next.empty() || next.size() * 10 > current.size() * 8)
+				break;
+
+			MeshLod lod;
+			lod.indexOffset = static_cast<unsigned int>(indices.size());
+			lod.indexCount = static_cast<unsigned int>(next.size());
+			lod.error = std::max(error, lods.back().error);
+			lods.push_back(lod);
+
+			indices.insert(indices.end(), next.begin(), next.end());
+			current.swap(next);
+		}
+		return lods;
+	}
+
+	// Collapses edges in cost order until the index count reaches targetIndexCount or nothing can collapse
+	// error receives the largest collapse error (square root of the quadric cost)
+	static std::vector<unsigned int> Simplify(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, std::size_t targetIndexCount, float& error)
+	{
+		unsigned int vertexCount = static_cast<unsigned int>(vertices.size());
+		error = 0.0f;
+
+		// Canonical vertex per position, topology is built on those
+		// seam : the vertices at that position differ in normal or UV, they only ever stay where they are
+		std::vector<unsigned int> canonical(vertexCount);
+		std::vector<bool> seam(vertexCount, false);
+		{
+			std::unordered_map<PositionKey, unsigned int, PositionKeyHash> positions;
+			positions.reserve(vertexCount);
+			for (unsigned int i = 0; i < vertexCount; i++)
+			{
+				PositionKey key(vertices[i].position);
+				std::unordered_map<PositionKey, unsigned int, PositionKeyHash>::iterator it = positions.find(key);
+				if (it == positions.end())
+				{
+					positions.insert(std::make_pair(key, i));
+					canonical[i] = i;
+				}
+				else
+				{
+					canonical[i] = it->second;
+					if (!sameAttributes(vertices[i], vertices[it->second]))
+						seam[it->second] = true;
+				}
+			}
+		}
+
+		// result keeps the real vertex indices, topology the canonical ones
+		std::vector<unsigned int> result = indices;
+		std::vector<unsigned int> topology(result.size());
+		for (unsigned int i = 0; i < result.size(); i++)
+			topology[i] = canonical[result[i]];
+
+		std::vector<bool> locked = seam;
+		lockBorders(topology, locked);
+
+		std::vector<Quadric> quadrics(vertexCount);
+		for (unsigned int t = 0; t + 2 < topology.size(); t += 3)
+		{
+			Quadric plane = Quadric::Plane(vertices[topology[t]].position, vertices[topology[t + 1]].position, vertices[topology[t + 2]].position);
+			for (unsigned int k = 0; k < 3; k++)
+				quadrics[topology[t + k]].Add(plane);
+		}
+
+		std::vector<unsigned int> remap(vertexCount);
+		for (unsigned int i = 0; i < vertexCount; i++)
+			remap[i] = i;
+
+		std::vector<Collapse> collapses;
+		std::vector<bool> touched(vertexCount);
+		std::vector<unsigned int> adjacencyStart, adjacency;
+
+		while (result.size() > targetIndexCount)
+		{
+			for (unsigned int i = 0; i < result.size(); i++)
+				topology[i] = canonical[result[i]];
+			buildAdjacency(topology, vertexCount, adjacencyStart, adjacency);
+
+			// Both directions of every edge, cheapest first. The target must not be a seam,
+			// the collapsed vertex takes over its attributes.
+			collapses.clear();
+			for (unsigned int t = 0; t + 2 < topology.size(); t += 3)
+			{
+				for (unsigned int k = 0; k < 3; k++)
+				{
+					unsigned int a = topology[t + k];
+					unsigned int b = topology[t + (k + 1) % 3];
+					if (!locked[a] && !seam[b])
+						collapses.push_back(Collapse(a, b, quadrics[a].Cost(quadrics[b], vertices[b].position)));
+					if (!locked[b] && !seam[a])
+						collapses.push_back(Collapse(b, a, quadrics[a].Cost(quadrics[b], vertices[a].position)));
+				}
+			}
+			std::sort(collapses.begin(), collapses.end());
+
+			// Independent set : a vertex takes part in at most one collapse per pass
+			std::fill(touched.begin(), touched.end(), false);
+			std::size_t remaining = result.size();
+			unsigned int collapsed = 0;
+			for (unsigned int c = 0; c < collapses.size() && remaining > targetIndexCount; c++)
+			{
+				unsigned int from = collapses[c].from;
+				unsigned int to = collapses[c].to;
+				if (touched[from] || touched[to] || !validCollapse(vertices, topology, adjacencyStart, adjacency, from, to))
+					continue;
+
+				remap[from] = to;
+				quadrics[to].Add(quadrics[from]);
+				error = std::max(error, std::sqrt(collapses[c].cost));
+				collapsed++;
+
+				for (unsigned int i = adjacencyStart[from]; i < adjacencyStart[from + 1]; i++)
+				{
+					unsigned int t = adjacency[i];
+					bool degenerate = false;
+					for (unsigned int k = 0; k < 3; k++)
+					{
+						touched[topology[t * 3 + k]] = true;
+						degenerate = degenerate || topology[t * 3 + k] == to;
+					}
+					if (degenerate)
+						remaining -= 3;
+				}
+			}
+
+			if (collapsed == 0)
+				break;
+
+			// Apply and drop the triangles that lost an edge
+			std::size_t write = 0;
+			for (std::size_t t = 0; t + 2 < result.size(); t += 3)
+			{
+				unsigned int corner[3];
+				for (unsigned int k = 0; k < 3; k++)
+				{
+					unsigned int position = canonical[result[t + k]];
+					corner[k] = remap[position] != position ? remap[position] : result[t + k];
+				}
+
+				if (canonical[corner[0]] == canonical[corner[1]] || canonical[corner[1]] == canonical[corner[2]] || canonical[corner[0]] == canonical[corner[2]])
+					continue;
+				result[write++] = corner[0];
+				result[write++] = corner[1];
+				result[write++] = corner[2];
+			}
+			result.resize(write);
+			topology.resize(write);
+		}
+
+		return result;
+	}
+private:
+	static const unsigned int MIN_TRIANGLES = 32;  // levels stop once they would fall below this
+
+	struct PositionKey
+	{
+		std::uint32_t bits[3];
+
+		explicit PositionKey(const glm::vec3& position)
+		{
+			std::memcpy(bits, &position[0], sizeof(bits));
+		}
+
+		bool operator==(const PositionKey& other) const
+		{
+			return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+		}
+	};
+
+	struct PositionKeyHash
+	{
+		std::size_t operator()(const PositionKey& key) const
+		{
+			return static_cast<std::size_t>((key.bits[0] * 73856093u) ^ (key.bits[1] * 19349663u) ^ (key.bits[2] * 83492791u));
+		}
+	};
+
+	// Symmetric 4x4 error quadric, 10 unique terms
+	struct Quadric
+	{
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+		Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+
+		static Quadric Plane(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+		{
+			Quadric q;
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(normal);
+			if (length <= 0.0f)
+				return q;
+
+			normal /= length;
+			double a = normal.x, b = normal.y, c = normal.z, d = -glm::dot(normal, p0);
+			q.a2 = a * a; q.ab = a * b; q.ac = a * c; q.ad = a * d;
+			q.b2 = b * b; q.bc = b * c; q.bd = b * d;
+			q.c2 = c * c; q.cd = c * d;
+			q.d2 = d * d;
+			return q;
+		}
+
+		void Add(const Quadric& q)
+		{
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+		}
+
+		// Sum of squared distances from p to both quadrics' planes
+		float Cost(const Quadric& other, const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double sa2 = a2 + other.a2, sab = ab + other.ab, sac = ac + other.ac, sad = ad + other.ad;
+			double sb2 = b2 + other.b2, sbc = bc + other.bc, sbd = bd + other.bd;
+			double sc2 = c2 + other.c2, scd = cd + other.cd, sd2 = d2 + other.d2;
+			double cost = sa2 * x * x + 2 * sab * x * y + 2 * sac * x * z + 2 * sad * x
+				+ sb2 * y * y + 2 * sbc * y * z + 2 * sbd * y
+				+ sc2 * z * z + 2 * scd * z
+				+ sd2;
+			return static_cast<float>(std::max(cost, 0.0));
+		}
+	};
+
+	struct Collapse
+	{
+		unsigned int from;
+		unsigned int to;
+		float cost;
+
+		Collapse(unsigned int from, unsigned int to, float cost) : from(from), to(to), cost(cost) {}
+
+		bool operator<(const Collapse& other) const
+		{
+			return cost < other.cost;
+		}
+	};
+
+	static bool sameAttributes(const Vertex& a, const Vertex& b)
+	{
+		return a.normal == b.normal && a.uv == b.uv;
+	}
+
+	// Edges used by a single triangle are borders, moving their vertices would open or shrink the outline
+	static void lockBorders(const std::vector<unsigned int>& indices, std::vector<bool>& locked)
+	{
+		std::unordered_map<std::uint64_t, unsigned int> edgeUse;
+		edgeUse.reserve(indices.size());
+		for (unsigned int t = 0; t + 2 < indices.size(); t += 3)
+		{
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				unsigned int a = indices[t + k];
+				unsigned int b = indices[t + (k + 1) % 3];
+				edgeUse[edgeKey(a, b)]++;
+			}
+		}
+
+		for (unsigned int t = 0; t + 2 < indices.size(); t += 3)
+		{
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				unsigned int a = indices[t + k];
+				unsigned int b = indices[t + (k + 1) % 3];
+				if (edgeUse[edgeKey(a, b)] == 1)
+				{
+					locked[a] = true;
+					locked[b] = true;
+				}
+			}
+		}
+	}
+
+	static std::uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return a < b ? (static_cast<std::uint64_t>(a) << 32) | b : (static_cast<std::uint64_t>(b) << 32) | a;
+	}
+
+	// Triangles per vertex (CSR)
+	static void buildAdjacency(const std::vector<unsigned int>& indices, unsigned int vertexCount, std::vector<unsigned int>& start, std::vector<unsigned int>& adjacency)
+	{
+		start.assign(vertexCount + 1, 0);
+		for (unsigned int i = 0; i < indices.size(); i++)
+			start[indices[i] + 1]++;
+		for (unsigned int v = 0; v < vertexCount; v++)
+			start[v + 1] += start[v];
+
+		adjacency.resize(indices.size());
+		std::vector<unsigned int> fill(start.begin(), start.end() - 1);
+		for (unsigned int i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	// Moving from onto to must not flip, squash or sharply turn any surviving triangle around from
+	static bool validCollapse(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<unsigned int>& start, const std::vector<unsigned int>& adjacency, unsigned int from, unsigned int to)
+	{
+		const float minNormalCosine = 0.5f;  // faces may turn by up to 60 degrees
+
+		for (unsigned int i = start[from]; i < start[from + 1]; i++)
+		{
+			unsigned int t = adjacency[i];
+			const unsigned int* triangle = &indices[t * 3];
+			if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+				continue; // removed by the collapse
+
+			glm::vec3 before[3], after[3];
+			for (unsigned int k = 0; k < 3; k++)
+			{
+				before[k] = vertices[triangle[k]].position;
+				after[k] = triangle[k] == from ? vertices[to].position : before[k];
+			}
+
+			glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+			float lengthBefore = glm::length(normalBefore);
+			float lengthAfter = glm::length(normalAfter);
+			if (lengthAfter <= lengthBefore * 1e-3f)
+				return false;
+			if (lengthBefore > 0.0f && glm::dot(normalBefore, normalAfter) < minNormalCosine * lengthBefore * lengthAfter)
+				return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "mesh_simplifier.h"
+#include "vertex_format.h"
+
+// Run of triangles inside a mesh's index buffer, small enough to be culled as a whole
+// The normal cone is stored as in meshoptimizer : every triangle normal lies within asin(coneCutoff) of coneAxis,
+// a cutoff of 1 means the triangles face too many ways for the cluster to ever be back facing.
+struct Meshlet
+{
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	glm::vec3 center;    // bounding sphere, model space
+	float radius;
+	glm::vec3 coneAxis;
+	float coneCutoff;
+};
+
+// Per pass culling state, everything in the mesh's model space
+struct MeshletCull
+{
+	glm::vec4 planes[6];
+	glm::vec3 cameraPosition;
+	bool frontFacesCulled;  // outline pass : the cones test front facing clusters instead
+
+	static MeshletCull FromMatrices(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model, const glm::vec3& cameraPosition, bool frontFacesCulled)
+	{
+		MeshletCull cull;
+
+		// Gribb-Hartmann : clip space planes pulled back through the whole transform land in model space
+		glm::mat4 m = projection * view * model;
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		cull.planes[0] = row3 + row0;
+		cull.planes[1] = row3 - row0;
+		cull.planes[2] = row3 + row1;
+		cull.planes[3] = row3 - row1;
+		cull.planes[4] = row3 + row2;
+		cull.planes[5] = row3 - row2;
+		for (unsigned int i = 0; i < 6; i++)
+			cull.planes[i] /= glm::length(glm::vec3(cull.planes[i]));
+
+		cull.cameraPosition = glm::vec3(glm::inverse(model) * glm::vec4(cameraPosition, 1.0f));
+		cull.frontFacesCulled = frontFacesCulled;
+		return cull;
+	}
+
+	// Frustum planes only, built from an identity model matrix this tests whole instances in world space
+	bool SphereVisible(const glm::vec3& center, float radius) const
+	{
+		for (unsigned int i = 0; i < 6; i++)
+		{
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+				return false;
+		}
+		return true;
+	}
+
+	bool Visible(const Meshlet& meshlet) const
+	{
+		if (!SphereVisible(meshlet.center, meshlet.radius))
+			return false;
+
+		glm::vec3 toCenter = meshlet.center - cameraPosition;
+		glm::vec3 axis = frontFacesCulled ? -meshlet.coneAxis : meshlet.coneAxis;
+		return glm::dot(toCenter, axis) < meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+	}
+};
+
+// Triangles and meshlets seen by the culled draw paths, reset by whoever reads them
+struct MeshletStats
+{
+	unsigned int tested;
+	unsigned int drawn;
+	unsigned int triangles;
+	unsigned int draws;
+	unsigned int instances;  // placements drawn through instanced commands, not meshlet culled
+};
+
+class MeshletBuilder
+{
+public:
+	static const unsigned int MAX_VERTICES = 64;
+	static const unsigned int MAX_TRIANGLES = 124;
+
+	// Splits every LOD range into meshlets, walking the triangles in their (cache optimized) order
+	// so each one is a contiguous range. Meshlets come out sorted by indexOffset.
+	static std::vector<Meshlet> Build(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, const std::vector<MeshLod>& lods)
+	{
+		std::vector<Meshlet> meshlets;
+		std::vector<unsigned int> usedBy(vertices.size(), ~0u);
+
+		for (unsigned int l = 0; l < lods.size(); l++)
+		{
+			unsigned int begin = lods[l].indexOffset;
+			unsigned int end = begin + lods[l].indexCount;
+
+			unsigned int start = begin;
+			unsigned int uniqueVertices = 0;
+			for (unsigned int t = begin; t + 2 < end; t += 3)
+			{
+				unsigned int id = static_cast<unsigned int>(meshlets.size());
+				unsigned int added = 0;
+				for (unsigned int k = 0; k < 3; k++)
+					added += usedBy[indices[t + k]] != id ? 1 : 0;
+
+				if (uniqueVertices + added > MAX_VERTICES || (t - start) / 3 >= MAX_TRIANGLES)
+				{
+					meshlets.push_back(bounds(vertices, indices, start, t));
+					id++;
+					start = t;
+					uniqueVertices = 0;
+					added = 3;
+				}
+
+				for (unsigned int k = 0; k < 3; k++)
+				{
+					if (usedBy[indices[t + k]] != id)
+					{
+						usedBy[indices[t + k]] = id;
+						uniqueVertices++;
+					}
+				}
+			}
+
+			if (end - start >= 3)
+				meshlets.push_back(bounds(vertices, indices, start, end));
+		}
+
+		return meshlets;
+	}
+private:
+	static Meshlet bounds(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, unsigned int begin, unsigned int end)
+	{
+		Meshlet meshlet;
+		meshlet.indexOffset = begin;
+		meshlet.indexCount = end - begin;
+
+		glm::vec3 boundsMin = vertices[indices[begin]].position;
+		glm::vec3 boundsMax = boundsMin;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			boundsMin = glm::min(boundsMin, vertices[indices[i]].position);
+			boundsMax = glm::max(boundsMax, vertices[indices[i]].position);
+		}
+
+		meshlet.center = (boundsMin + boundsMax) * 0.5f;
+		meshlet.radius = 0.0f;
+		for (unsigned int i = begin; i < end; i++)
+			meshlet.radius = std::max(meshlet.radius, glm::length(vertices[indices[i]].position - meshlet.center));
+
+		// Cone around the average face direction, widened to the furthest face
+		glm::vec3 axis(0.0f);
+		for (unsigned int t = begin; t < end; t += 3)
+		{
+			glm::vec3 normal = faceNormal(vertices, indices, t);
+			if (normal != glm::vec3(0.0f))
+				axis += glm::normalize(normal);
+		}
+
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+		if (glm::length(axis) <= 0.0f)
+			return meshlet;
+		axis = glm::normalize(axis);
+
+		float minDot = 1.0f;
+		for (unsigned int t = begin; t < end; t += 3)
+		{
+			glm::vec3 normal = faceNormal(vertices, indices, t);
+			if (normal != glm::vec3(0.0f))
+				minDot = std::min(minDot, glm::dot(axis, glm::normalize(normal)));
+		}
+
+		// Spread past ~84 degrees leaves nothing to cull, keep the cutoff at 1
+		meshlet.coneAxis = axis;
+		if (minDot > 0.1f)
+			meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		return meshlet;
+	}
+
+	static glm::vec3 faceNormal(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, unsigned int t)
+	{
+		const glm::vec3& a = vertices[indices[t]].position;
+		const glm::vec3& b = vertices[indices[t + 1]].position;
+		const glm::vec3& c = vertices[indices[t + 2]].position;
+		return glm::cross(b - a, c - a);
+	}
+};
@@ -12,16 +12,132 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "compressed_texture.h"
+#include "gl_state.h"
+#include "glb_file.h"
 #include "mesh.h"
+#include "mesh_cache.h"
 #include "shader.h"
+#include "upload_ring.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <vector>
 
+// Decoded image waiting for upload, mips are built on the worker so the GL thread only copies them in
+// With block compression enabled, compressed holds the encoded mip chain instead
+struct TextureData
+{
+    TextureRef ref;
+    int width, height, components;
+    std::vector<MipChain::Level> mips;
+    std::unique_ptr<CompressedTexture> compressed;
+    double decodeMs;
+
+    std::uint64_t contentHash;  // hash of the encoded source bytes (and the sRGB flag)
+    bool decodeSkipped;         // content was already resident in the AssetRegistry
+    bool reused;                // AssetRegistry handed out an existing GL texture
+
+    TextureData() : width(0), height(0), components(0), decodeMs(0.0), contentHash(0), decodeSkipped(false), reused(false) {}
+
+    bool Loaded() const
+    {
+        return compressed || !mips.empty();
+    }
+
+    std::size_t Bytes() const
+    {
+        if (compressed)
+            return compressed->TotalBytes();
+
+        std::size_t total = 0;
+        for (unsigned int i = 0; i < mips.size(); i++)
+            total += mips[i].texels.size();
+        return total;
+    }
+};
+
+// Per texture load counters, bytes is the payload handed to GL over every mip level
+struct TextureStats
+{
+    std::string path;
+    double decodeMs;
+    double uploadMs;
+    std::size_t bytes;
+};
+
+// Model::Memory, entries marked shared point at GPU objects another mesh or model uploaded
+struct ModelMemory
+{
+    struct Entry
+    {
+        std::string name;
+        MemoryUsage usage;
+        bool shared;
+    };
+
+    MemoryUsage total;
+    std::vector<Entry> meshes;
+    std::vector<Entry> textures;
+};
+
+// CPU-side result of importing a model file, built without touching GL
+struct ModelData
+{
+    std::string path;
+    std::string directory;
+    bool cacheHit;
+    double importMs;
+
+    MappedFile source;                  // model file, embedded textures are decoded straight from it
+    MeshCache cache;                    // mapped geometry on a warm load
+    std::vector<MeshData> meshes;       // imported geometry on a cold load
+    std::vector<TextureData> textures;  // one per unique texture path
+    std::vector<PackedMesh> packed;     // GPU-ready vertices and indices per mesh on a cold load, a hit uploads the mapped ones
+    std::vector<std::uint64_t> meshHashes;
+
+    ModelData() : cacheHit(false), importMs(0.0) {}
+
+    unsigned int MeshCount() const
+    {
+        return static_cast<unsigned int>(cacheHit ? cache.Meshes().size() : meshes.size());
+    }
+
+    const std::vector<TextureRef>& MeshTextures(unsigned int meshIdx) const
+    {
+        return cacheHit ? cache.Meshes()[meshIdx].textures : meshes[meshIdx].textures;
+    }
+
+    const std::vector<MeshLod>& MeshLods(unsigned int meshIdx) const
+    {
+        return cacheHit ? cache.Meshes()[meshIdx].lods : meshes[meshIdx].lods;
+    }
+
+    const std::vector<Meshlet>& MeshMeshlets(unsigned int meshIdx) const
+    {
+        return cacheHit ? cache.Meshes()[meshIdx].meshlets : meshes[meshIdx].meshlets;
+    }
+
+    PackedGeometry MeshPacked(unsigned int meshIdx) const
+    {
+        return cacheHit ? cache.Meshes()[meshIdx].packed : packed[meshIdx].View();
+    }
+
+    std::uint64_t MeshHash(unsigned int meshIdx) const
+    {
+        return cacheHit ? cache.Meshes()[meshIdx].contentHash : meshHashes[meshIdx];
+    }
+};
+
 class Model
 {
 public:
@@ -29,28 +145,290 @@ public:
 	std::vector<Mesh> meshes;
 	std::string directory;
 	bool gammaCorrection;
+	VertexFormat vertexFormat;
+	unsigned int meshSteps;  // MeshSteps run after Assimp
+	VertexWelder::Tolerance weldTolerance;
+	GeometryResidency residency;  // what meshes keep in system memory after upload
 
     std::string defaultTexturePath; // Store the default texture path
 
-	Model(std::string path, std::string defaultTexPath = "texture.png", bool gamma = false) : defaultTexturePath(defaultTexPath), gammaCorrection(gamma)
+    std::vector<TextureStats> textureStats;
+
+	Model(std::string path, std::string defaultTexPath = "texture.png", bool gamma = false, VertexFormat format = VertexFormat::Compact(), unsigned int steps = MeshSteps_Default, VertexWelder::Tolerance tolerance = VertexWelder::Tolerance(), GeometryResidency geometryResidency = GeometryResidency::Drop) : gammaCorrection(gamma), vertexFormat(format), meshSteps(steps), weldTolerance(tolerance), residency(geometryResidency), defaultTexturePath(defaultTexPath), resident(false), deleted(false), uploadCursor(0), itemStarted(false), uploadLevel(0), uploadRow(0), itemUploadMs(0.0), uploadMs(0.0), boundsMin(0.0f), boundsMax(0.0f)
 	{
-        loadModel(path);
+        std::unique_ptr<ModelData> data = Import(path, defaultTexturePath, gammaCorrection, vertexFormat, meshSteps, weldTolerance, residency);
+        while (!UploadStep(*data)) {}
+
         std::cout << meshes.size() << std::endl;
 	}
 
-	void Draw(Shader& shader)
+    // Copies would alias the same GL objects and release them twice, place models through a ModelStore instead
+    Model(const Model&) = delete;
+    Model& operator=(const Model&) = delete;
+    Model(Model&&) = default;
+    Model& operator=(Model&&) = default;
+
+    // Empty model that is filled later through UploadStep (see ModelStreamer)
+    static std::shared_ptr<Model> Deferred(std::string defaultTexPath = "texture.png", bool gamma = false, VertexFormat format = VertexFormat::Compact(), unsigned int steps = MeshSteps_Default, VertexWelder::Tolerance tolerance = VertexWelder::Tolerance(), GeometryResidency geometryResidency = GeometryResidency::Drop)
+    {
+        return std::shared_ptr<Model>(new Model(DeferredTag(), defaultTexPath, gamma, format, steps, tolerance, geometryResidency));
+    }
+
+    // Parses, converts and decodes everything a model needs without touching GL, safe on any thread
+    // gamma picks sRGB texture formats and linear-space mip filtering, format the GPU vertex layout,
+    // meshSteps the MeshSteps run on the imported geometry and weldTolerance the grid of MeshSteps_WeldVertices
+    // (both part of the MeshCache key), residency whether the full precision geometry must survive until upload
+    static std::unique_ptr<ModelData> Import(const std::string& path, const std::string& defaultTexturePath, bool gamma = false, VertexFormat format = VertexFormat::Compact(), unsigned int meshSteps = MeshSteps_Default, const VertexWelder::Tolerance& weldTolerance = VertexWelder::Tolerance(), GeometryResidency residency = GeometryResidency::Drop)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        std::unique_ptr<ModelData> data(new ModelData());
+        data->path = path;
+        data->directory = path.substr(0, path.find_last_of('/'));
+
+        // Warm Load : keyed by source content, import flags, vertex format and the "*0" fallback
+        std::string cachePath = path + ".meshcache";
+        std::uint64_t cacheKey = 0;
+        if (data->source.Open(path))
+            cacheKey = MeshCache::Key(data->source, IMPORT_FLAGS, meshSteps, weldTolerance, format, defaultTexturePath);
+
+        // Texture decodes are queued on the pool as soon as the references are known,
+        // so they overlap with the mesh conversion queued behind them
+        std::vector<PendingTexture> pendingTextures;
+
+        data->cacheHit = cacheKey != 0 && data->cache.Open(cachePath, cacheKey);
+        if (data->cacheHit)
+        {
+            for (unsigned int i = 0; i < data->MeshCount(); i++)
+                requestDecodes(data->directory, data->source, data->MeshTextures(i), gamma, pendingTextures);
+        }
+        else
+        {
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(path, IMPORT_FLAGS);
+
+            if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+            {
+                std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+                return data;
+            }
+
+            std::vector<const aiMesh*> sceneMeshes;
+            collectMeshes(scene->mRootNode, scene, sceneMeshes);
+
+            // Embedded images of a GLB are found through its JSON, anything else falls back to Assimp's copy
+            GlbFile glb;
+            if (data->source.IsOpen())
+                glb.Parse(data->source.Data(), data->source.Size());
+
+            bool decodedTextures = false;
+            std::vector<std::vector<TextureRef>> materialRefs(scene->mNumMaterials);
+            for (unsigned int i = 0; i < scene->mNumMaterials; i++)
+                decodedTextures |= materialTextureRefs(scene, scene->mMaterials[i], glb, defaultTexturePath, materialRefs[i]);
+
+            for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+                requestDecodes(data->directory, data->source, materialRefs[sceneMeshes[i]->mMaterialIndex], gamma, pendingTextures);
+
+            processMeshes(sceneMeshes, materialRefs, meshSteps, weldTolerance, data->meshes);
+            packMeshes(*data, format);
+
+            // The cache only keeps paths and file ranges, pixels decoded from the aiScene would be lost on a hit
+            if (decodedTextures)
+                std::cout << "Mesh cache skipped for " << path << " : embedded textures decoded in memory" << std::endl;
+            else if (cacheKey != 0 && !MeshCache::Write(cachePath, cacheKey, data->meshes, data->packed, data->meshHashes))
+                std::cout << "ERROR::MESH_CACHE:: Failed to write " << cachePath << std::endl;
+
+            // Only the packed copies go to the GPU, unless the model keeps them (GeometryResidency::Keep takes them over in UploadStep)
+            for (unsigned int i = 0; residency != GeometryResidency::Keep && i < data->meshes.size(); i++)
+            {
+                std::vector<Vertex>().swap(data->meshes[i].vertices);
+                std::vector<unsigned int>().swap(data->meshes[i].indices);
+            }
+        }
+
+        for (unsigned int i = 0; i < pendingTextures.size(); i++)
+            data->textures.push_back(pendingTextures[i].image.get());
+
+        data->importMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return data;
+    }
+
+    // GL thread only : uploads about maxBytes of one texture or mesh per call, returns true once the model is resident.
+    // With a ring the chunks are staged through it and a stalled ring makes no progress (see ModelStreamer::Update),
+    // without one they go straight from memory. The defaults upload a whole texture or mesh per call.
+    bool UploadStep(ModelData& data, std::size_t maxBytes = std::numeric_limits<std::size_t>::max(), UploadRing* ring = nullptr)
+    {
+        if (resident || deleted)
+            return true;
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        unsigned int textureCount = static_cast<unsigned int>(data.textures.size());
+        if (uploadCursor == 0)
+            directory = data.directory;
+
+        if (uploadCursor < textureCount)
+        {
+            TextureData& image = data.textures[uploadCursor];
+
+            // Shared textures come from the AssetRegistry, the rest are created in one batch ahead of the first upload
+            if (uploadCursor == 0 && !itemStarted)
+                acquireTextures(data);
+
+            Texture& texture = loadedTextures[uploadCursor];
+            if (!itemStarted && !image.reused)
+            {
+                // Same bytes under another path of this model may have been registered a step ago
+                GLuint existing = AssetRegistry::Get().AcquireTexture(texture.contentHash, &texture.gpuBytes);
+                if (existing != 0)
+                {
+                    glDeleteTextures(1, &texture.ID);
+                    GLState::Get().TextureDeleted(texture.ID);
+                    texture.ID = existing;
+                    image.reused = true;
+                }
+                else
+                {
+                    // Released since the decode was skipped, load it after all
+                    if (image.decodeSkipped)
+                        image = decodeTexture(data.directory, data.source, image.ref, gammaCorrection);
+
+                    allocateTexture(texture.ID, image, gammaCorrection);
+                }
+            }
+            itemStarted = true;
+
+            if (!image.reused)
+            {
+                if (!uploadTexture(texture.ID, image, uploadLevel, uploadRow, maxBytes, ring))
+                    return continueStep(start);
+
+                texture.gpuBytes = image.Bytes();
+                AssetRegistry::Get().RegisterTexture(texture.contentHash, texture.ID, texture.gpuBytes);
+            }
+
+            TextureStats stats;
+            stats.path = image.ref.path;
+            stats.decodeMs = image.decodeMs;
+            stats.uploadMs = itemUploadMs + std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            stats.bytes = image.reused ? 0 : image.Bytes();
+            textureStats.push_back(stats);
+            textureShared.push_back(image.reused);
+        }
+        else if (uploadCursor < textureCount + data.MeshCount())
+        {
+            unsigned int meshIdx = uploadCursor - textureCount;
+
+            if (!itemStarted)
+            {
+                const std::vector<TextureRef>& refs = data.MeshTextures(meshIdx);
+                std::vector<Texture> textures;
+                for (unsigned int t = 0; t < refs.size(); t++)
+                    textures.push_back(findTexture(refs[t]));
+
+                meshes.push_back(Mesh(data.MeshPacked(meshIdx), textures, data.MeshLods(meshIdx), data.MeshMeshlets(meshIdx), data.MeshHash(meshIdx), true));
+                itemStarted = true;
+            }
+
+            Mesh& mesh = meshes.back();
+            if (!mesh.UploadGeometry(data.MeshPacked(meshIdx), maxBytes, ring))
+                return continueStep(start);
+            if (!data.cacheHit)
+                data.packed[meshIdx] = PackedMesh();
+
+            if (residency == GeometryResidency::Keep)
+            {
+                if (data.cacheHit)
+                {
+                    const MeshCache::MeshView& view = data.cache.Meshes()[meshIdx];
+                    mesh.vertices.assign(view.vertices, view.vertices + view.vertexCount);
+                    mesh.indices.assign(view.indices, view.indices + view.indexCount);
+                }
+                else
+                {
+                    mesh.vertices.swap(data.meshes[meshIdx].vertices);
+                    mesh.indices.swap(data.meshes[meshIdx].indices);
+                }
+            }
+            mesh.ApplyResidency(residency);
+
+            boundsMin = meshIdx == 0 ? mesh.boundsMin : glm::min(boundsMin, mesh.boundsMin);
+            boundsMax = meshIdx == 0 ? mesh.boundsMax : glm::max(boundsMax, mesh.boundsMax);
+        }
+        else
+        {
+            resident = true;
+            MemoryUsage usage = Memory().total;
+            std::cout << "MeshCache " << (data.cacheHit ? "HIT" : "MISS") << " : " << data.path << " (" << meshes.size() << " meshes, import " << data.importMs << " ms, upload " << uploadMs << " ms, "
+                << usage.cpuBytes << " bytes CPU, " << usage.gpuBytes << " bytes GPU)" << std::endl;
+            for (unsigned int i = 0; i < textureStats.size(); i++)
+                std::cout << "Texture " << textureStats[i].path << " : decode " << textureStats[i].decodeMs << " ms, upload " << textureStats[i].uploadMs << " ms, " << textureStats[i].bytes << " bytes" << std::endl;
+            return true;
+        }
+
+        uploadCursor++;
+        itemStarted = false;
+        uploadLevel = uploadRow = 0;
+        itemUploadMs = 0.0;
+        uploadMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return false;
+    }
+
+    bool IsResident() const
+    {
+        return resident;
+    }
+
+    // Per mesh and per texture byte counts, shared entries are counted here as well as in every other model using them
+    ModelMemory Memory() const
+    {
+        ModelMemory report;
+        report.total.cpuBytes = 0;
+        report.total.gpuBytes = 0;
+
+        for (unsigned int i = 0; i < meshes.size(); i++)
+        {
+            ModelMemory::Entry entry;
+            entry.name = "mesh " + std::to_string(i);
+            entry.usage = meshes[i].Memory();
+            entry.shared = meshes[i].sharedBuffers;
+            report.meshes.push_back(entry);
+        }
+
+        // Decoded texels are gone once uploaded, textures only take GPU memory
+        for (unsigned int i = 0; i < loadedTextures.size(); i++)
+        {
+            ModelMemory::Entry entry;
+            entry.name = loadedTextures[i].path;
+            entry.usage.cpuBytes = 0;
+            entry.usage.gpuBytes = loadedTextures[i].gpuBytes;
+            entry.shared = i < textureShared.size() && textureShared[i];
+            report.textures.push_back(entry);
+        }
+
+        for (unsigned int i = 0; i < report.meshes.size(); i++)
+        {
+            report.total.cpuBytes += report.meshes[i].usage.cpuBytes;
+            report.total.gpuBytes += report.meshes[i].usage.gpuBytes;
+        }
+        for (unsigned int i = 0; i < report.textures.size(); i++)
+            report.total.gpuBytes += report.textures[i].usage.gpuBytes;
+        return report;
+    }
+
+	void Draw(const Shader& shader) const
 	{
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
 
-    void Draw(Shader& shader, int meshIdx)
+    void Draw(const Shader& shader, int meshIdx) const
     {
         if (meshIdx >= meshes.size()) return;
         meshes[meshIdx].Draw(shader);
     }
 
-    void Draw(Shader& shader, int meshStart, int meshEnd)
+    void Draw(const Shader& shader, int meshStart, int meshEnd) const
     {
         if (meshEnd >= meshes.size()) return;
         for (unsigned int i = meshStart; i < meshEnd; i++) {
@@ -58,196 +436,672 @@ public:
         }
     }
 
-    void Draw() 
+    void Draw() const
     {
         for (unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].DrawBasic();
     }
 
-    void Draw(int meshIdx)
+    void Draw(int meshIdx) const
     {
         if (meshIdx >= meshes.size()) return;
         meshes[meshIdx].DrawBasic();
     }
 
-    void Draw(int meshStart, int meshEnd)
+    void Draw(int meshStart, int meshEnd) const
     {
         if (meshEnd >= meshes.size()) return;
         for (unsigned int i = meshStart; i < meshEnd; i++)
             meshes[i].DrawBasic();
     }
 
-    void Delete() const
+    // Each mesh at the coarsest LOD within maxError, in model units (see Scene::Render)
+    void DrawLod(const Shader& shader, float maxError) const
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Draw(shader, meshes[i].SelectLod(maxError));
+    }
+
+    void DrawLod(float maxError) const
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].DrawBasic(meshes[i].SelectLod(maxError));
+    }
+
+    // Same, dropping the meshlets cull rejects
+    void DrawLod(const Shader& shader, float maxError, const MeshletCull& cull, MeshletStats& stats) const
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].Draw(shader, meshes[i].SelectLod(maxError), cull, stats);
+    }
+
+    void DrawLod(float maxError, const MeshletCull& cull, MeshletStats& stats) const
+    {
+        for (unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].DrawBasic(meshes[i].SelectLod(maxError), cull, stats);
+    }
+
+    // Model space box around every mesh, valid once resident
+    glm::vec3 BoundsMin() const
+    {
+        return boundsMin;
+    }
+
+    glm::vec3 BoundsMax() const
+    {
+        return boundsMax;
+    }
+
+    // Releases every mesh and texture reference once, later calls (and upload steps still queued by a streamer) do nothing
+    void Delete()
     {
         for (unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Delete();
+
+        for (unsigned int i = 0; i < loadedTextures.size(); i++)
+            AssetRegistry::Get().ReleaseTexture(loadedTextures[i].contentHash, loadedTextures[i].ID);
+
+        meshes.clear();
+        loadedTextures.clear();
+        deleted = true;
     }
 private:
-	void loadModel(std::string path)
-	{
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_SortByPType);
+    static const unsigned int IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_SortByPType;
 
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-		{
-            std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
-			return;
-		}
+    struct DeferredTag {};
 
-		directory = path.substr(0, path.find_last_of('/'));
+    bool resident;
+    bool deleted;
+    std::vector<bool> textureShared;  // per loadedTextures entry, came from the AssetRegistry
+    unsigned int uploadCursor;
+    bool itemStarted;          // the texture or mesh at uploadCursor is partly uploaded
+    unsigned int uploadLevel;  // next mip level and row (block row when compressed) of that texture
+    unsigned int uploadRow;
+    double itemUploadMs;
+    double uploadMs;
+    glm::vec3 boundsMin, boundsMax;
 
-		processNode(scene->mRootNode, scene);
-	}
+    Model(DeferredTag, std::string defaultTexPath, bool gamma, VertexFormat format, unsigned int steps, VertexWelder::Tolerance tolerance, GeometryResidency geometryResidency) : gammaCorrection(gamma), vertexFormat(format), meshSteps(steps), weldTolerance(tolerance), residency(geometryResidency), defaultTexturePath(defaultTexPath), resident(false), deleted(false), uploadCursor(0), itemStarted(false), uploadLevel(0), uploadRow(0), itemUploadMs(0.0), uploadMs(0.0), boundsMin(0.0f), boundsMax(0.0f) {}
+
+    struct PendingTexture
+    {
+        std::string path;
+        std::future<TextureData> image;
+    };
 
-	void processNode(aiNode* node, const aiScene* scene)
+	static void processMeshes(const std::vector<const aiMesh*>& sceneMeshes, const std::vector<std::vector<TextureRef>>& materialRefs, unsigned int meshSteps, const VertexWelder::Tolerance& weldTolerance, std::vector<MeshData>& out)
 	{
-		for (unsigned int i = 0; i < node->mNumMeshes; i++)
-		{
+        // Mesh order follows node order no matter which worker finishes first
+        ThreadPool& pool = ThreadPool::Shared();
+        std::vector<std::future<MeshData>> pending;
+        for (unsigned int i = 0; i < sceneMeshes.size(); i++)
+        {
+            const aiMesh* mesh = sceneMeshes[i];
+            const std::vector<TextureRef>& refs = materialRefs[mesh->mMaterialIndex];
+            pending.push_back(pool.Submit([mesh, &refs]() { return convertMesh(mesh, refs); }));
+        }
+
+        for (unsigned int i = 0; i < pending.size(); i++)
+            out.push_back(pending[i].get());
+
+        // Large meshes are welded from here with the whole pool, the others inside their own task below
+        bool weld = (meshSteps & MeshSteps_WeldVertices) != 0;
+        for (unsigned int i = 0; i < out.size(); i++)
+        {
+            if (weld && out[i].vertices.size() >= VertexWelder::PARALLEL_MIN_VERTICES)
+                out[i].weldReport = VertexWelder::Weld(out[i].vertices, out[i].indices, weldTolerance, &pool);
+        }
+
+        std::vector<std::future<void>> steps;
+        for (unsigned int i = 0; i < out.size(); i++)
+        {
+            MeshData* mesh = &out[i];
+            bool weldHere = weld && mesh->vertices.size() < VertexWelder::PARALLEL_MIN_VERTICES;
+            steps.push_back(pool.Submit([mesh, meshSteps, weldTolerance, weldHere]() { runMeshSteps(*mesh, meshSteps, weldTolerance, weldHere); }));
+        }
+
+        for (unsigned int i = 0; i < steps.size(); i++)
+        {
+            steps[i].get();
+
+            const MeshData& mesh = out[i];
+            if (weld)
+                std::cout << "Mesh " << i << " weld : " << mesh.weldReport.before << " -> " << mesh.weldReport.after << " vertices (" << mesh.weldReport.ms << " ms)" << std::endl;
 
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
-		}
+            if (meshSteps & MeshSteps_OptimizeCache)
+                std::cout << "Mesh " << i << " vertex cache : ACMR " << mesh.cacheReport.before.acmr << " -> " << mesh.cacheReport.after.acmr
+                    << ", ATVR " << mesh.cacheReport.before.atvr << " -> " << mesh.cacheReport.after.atvr << std::endl;
 
-		for (unsigned int i = 0; i < node->mNumChildren; i++)
-		{
-			processNode(node->mChildren[i], scene);
-		}
+            if (meshSteps & MeshSteps_GenerateLods)
+            {
+                std::cout << "Mesh " << i << " LODs :";
+                for (unsigned int l = 0; l < mesh.lods.size(); l++)
+                    std::cout << " " << mesh.lods[l].indexCount / 3 << " tris (error " << mesh.lods[l].error << ")";
+                std::cout << std::endl;
+            }
+
+            if (meshSteps & MeshSteps_BuildMeshlets)
+                std::cout << "Mesh " << i << " : " << mesh.meshlets.size() << " meshlets" << std::endl;
+        }
 	}
 
-    Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+    // Quantizes every imported mesh on the pool and reports what the encoding cost, a cache hit maps the packed bytes instead
+    static void packMeshes(ModelData& data, VertexFormat format)
     {
-        std::vector<Vertex> vertices;
-        std::vector<unsigned int> indices;
-        std::vector<Texture> textures;
+        ThreadPool& pool = ThreadPool::Shared();
+        std::vector<std::future<PackedMesh>> pending;
+        for (unsigned int i = 0; i < data.meshes.size(); i++)
+        {
+            const MeshData& mesh = data.meshes[i];
+            const Vertex* vertices = mesh.vertices.data();
+            unsigned int vertexCount = static_cast<unsigned int>(mesh.vertices.size());
+            const unsigned int* indices = mesh.indices.data();
+            unsigned int indexCount = static_cast<unsigned int>(mesh.indices.size());
+            pending.push_back(pool.Submit([=]() { return VertexPacker::Pack(vertices, vertexCount, indices, indexCount, format); }));
+        }
 
+        for (unsigned int i = 0; i < pending.size(); i++)
+        {
+            data.packed.push_back(pending[i].get());
+
+            // Content keys for AssetRegistry, so identical meshes across models share one upload
+            const PackedMesh& packed = data.packed.back();
+            data.meshHashes.push_back(Mesh::Hash(packed.View()));
+
+            std::cout << "Mesh " << i << " of " << data.path << " : " << packed.format.Stride() << " bytes/vertex (" << sizeof(Vertex) << " full), "
+                << (packed.indexType == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit indices, max error position " << packed.positionError
+                << ", normal " << packed.normalError << " deg, uv " << packed.uvError << std::endl;
+        }
+    }
+
+    static void collectMeshes(const aiNode* node, const aiScene* scene, std::vector<const aiMesh*>& out)
+    {
+        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+            out.push_back(scene->mMeshes[node->mMeshes[i]]);
+
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+            collectMeshes(node->mChildren[i], scene, out);
+    }
+
+    // Runs on a worker thread : no GL calls and no writes to shared state
+    static MeshData convertMesh(const aiMesh* mesh, const std::vector<TextureRef>& materialRefs)
+    {
+        MeshData data;
+        data.vertices.resize(mesh->mNumVertices);
+
+        const aiVector3D* uvs = mesh->mTextureCoords[0];
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
-            glm::vec3 vector;
+            Vertex& vertex = data.vertices[i];
 
-            vector.x = mesh->mVertices[i].x;
-            vector.y = mesh->mVertices[i].y;
-            vector.z = mesh->mVertices[i].z;
-            vertex.position = vector;
+            vertex.position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
 
             if (mesh->HasNormals())
-            {
-                vector.x = mesh->mNormals[i].x;
-                vector.y = mesh->mNormals[i].y;
-                vector.z = mesh->mNormals[i].z;
-                vertex.normal = vector;
-            }
+                vertex.normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+            else
+                vertex.normal = glm::vec3(0.0f, 0.0f, 0.0f);
 
-            if (mesh->mTextureCoords[0])
-            {
-                glm::vec2 vec;
-              
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.uv = vec;
-            }
+            if (uvs)
+                vertex.uv = glm::vec2(uvs[i].x, uvs[i].y);
             else
-            {
                 vertex.uv = glm::vec2(0.0f, 0.0f);
-            }
-
-            vertices.push_back(vertex);
         }
 
+        unsigned int indexCount = 0;
+        for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+            indexCount += mesh->mFaces[i].mNumIndices;
+
+        data.indices.resize(indexCount);
+
+        unsigned int* index = data.indices.data();
         for (unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace& face = mesh->mFaces[i];
 
             for (unsigned int j = 0; j < face.mNumIndices; j++)
-                indices.push_back(face.mIndices[j]);
+                *index++ = face.mIndices[j];
         }
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
 
-        std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        
-        std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        data.textures = materialRefs;
+        return data;
+    }
+
+    // Worker thread as well : the MeshSteps after conversion, weld only when it wasn't done with the pool already
+    static void runMeshSteps(MeshData& data, unsigned int meshSteps, const VertexWelder::Tolerance& weldTolerance, bool weld)
+    {
+        if (weld)
+            data.weldReport = VertexWelder::Weld(data.vertices, data.indices, weldTolerance);
 
-        return Mesh(vertices, indices, textures);
+        if (meshSteps & MeshSteps_GenerateLods)
+        {
+            data.lods = MeshSimplifier::BuildChain(data.vertices, data.indices);
+        }
+        else
+        {
+            MeshLod full = { 0, static_cast<unsigned int>(data.indices.size()), 0.0f };
+            data.lods.push_back(full);
+        }
+
+        if (meshSteps & MeshSteps_OptimizeCache)
+            data.cacheReport = MeshOptimizer::Optimize(data.vertices, data.indices, data.lods);
+
+        // After the reordering : meshlets are runs of the final triangle order
+        if (meshSteps & MeshSteps_BuildMeshlets)
+            data.meshlets = MeshletBuilder::Build(data.vertices, data.indices, data.lods);
+    }
+
+    // True when some texture had to be decoded out of the aiScene (see decodeEmbedded)
+    static bool materialTextureRefs(const aiScene* scene, const aiMaterial* material, const GlbFile& glb, const std::string& defaultTexturePath, std::vector<TextureRef>& out)
+    {
+        bool decoded = materialTextureRefs(scene, material, aiTextureType_DIFFUSE, "diffuse", glb, defaultTexturePath, out);
+        decoded |= materialTextureRefs(scene, material, aiTextureType_SPECULAR, "specular", glb, defaultTexturePath, out);
+        return decoded;
     }
 
-    std::vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
+    static bool materialTextureRefs(const aiScene* scene, const aiMaterial* mat, aiTextureType type, const char* typeName, const GlbFile& glb, const std::string& defaultTexturePath, std::vector<TextureRef>& out)
     {
-        std::vector<Texture> textures;
+        bool decoded = false;
         for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
 
-            bool skip = false;
-            for (unsigned int j = 0; j < loadedTextures.size(); j++)
+            TextureRef ref;
+            ref.type = typeName;
+            ref.path = str.C_Str();
+
+            const aiTexture* embedded = scene->GetEmbeddedTexture(str.C_Str());
+            if (embedded && !locateEmbedded(scene, embedded, glb, ref))
+            {
+                ref.decoded = decodeEmbedded(embedded);
+                decoded |= ref.decoded != nullptr;
+            }
+
+            // Only a texture that is really missing gets the default
+            if ((embedded || ref.path[0] == '*') && ref.embeddedSize == 0 && !ref.decoded)
+            {
+                std::cout << "Embedded texture " << ref.path << " not found, using " << defaultTexturePath << std::endl;
+                ref.path = defaultTexturePath; // Use the default texture path
+            }
+
+            out.push_back(ref);
+        }
+        return decoded;
+    }
+
+    // Compressed embedded payloads (PNG/JPEG inside a GLB) are stored verbatim in the BIN chunk,
+    // so the decoder can read them from the mapping : images[N].bufferView gives the range
+    static bool locateEmbedded(const aiScene* scene, const aiTexture* embedded, const GlbFile& glb, TextureRef& ref)
+    {
+        if (embedded->mHeight != 0 || embedded->mWidth == 0)
+            return false; // raw texels, not a byte range of the file
+
+        // Assimp numbers its embedded textures "*N" in the order it adds them to mTextures
+        unsigned int index = 0;
+        while (index < scene->mNumTextures && scene->mTextures[index] != embedded)
+            index++;
+
+        std::uint64_t offset, size;
+        if (!glb.EmbeddedImageRange(index, offset, size) || size != embedded->mWidth)
+            return false;
+
+        ref.embeddedOffset = offset;
+        ref.embeddedSize = size;
+        return true;
+    }
+
+    // Payloads the file has no range for (data URIs, other formats' embedded textures) are decoded from Assimp's copy,
+    // raw texels are taken as they are. nullptr when the payload can't be decoded.
+    static std::shared_ptr<const DecodedImage> decodeEmbedded(const aiTexture* embedded)
+    {
+        std::shared_ptr<DecodedImage> image = std::make_shared<DecodedImage>();
+        if (embedded->mHeight == 0)
+        {
+            int width, height, components;
+            unsigned char* pixels = stbi_load_from_memory(reinterpret_cast<const unsigned char*>(embedded->pcData), static_cast<int>(embedded->mWidth), &width, &height, &components, 0);
+            if (!pixels)
+                return nullptr;
+
+            image->pixels.assign(pixels, pixels + static_cast<std::size_t>(width) * height * components);
+            image->width = width;
+            image->height = height;
+            image->components = components;
+            stbi_image_free(pixels);
+            return image;
+        }
+
+        // aiTexel is BGRA
+        std::size_t texelCount = static_cast<std::size_t>(embedded->mWidth) * embedded->mHeight;
+        image->pixels.resize(texelCount * 4);
+        for (std::size_t i = 0; i < texelCount; i++)
+        {
+            const aiTexel& texel = embedded->pcData[i];
+            unsigned char* rgba = &image->pixels[i * 4];
+            rgba[0] = texel.r;
+            rgba[1] = texel.g;
+            rgba[2] = texel.b;
+            rgba[3] = texel.a;
+        }
+        image->width = static_cast<int>(embedded->mWidth);
+        image->height = static_cast<int>(embedded->mHeight);
+        image->components = 4;
+        return image;
+    }
+
+    // One decode per unique path, kept in first-reference order
+    static void requestDecodes(const std::string& directory, const MappedFile& source, const std::vector<TextureRef>& refs, bool gamma, std::vector<PendingTexture>& pending)
+    {
+        for (unsigned int t = 0; t < refs.size(); t++)
+        {
+            bool known = false;
+            for (unsigned int j = 0; j < pending.size(); j++)
             {
-                if (std::strcmp(loadedTextures[j].path.data(), str.C_Str()) == 0)
+                if (pending[j].path == refs[t].path)
                 {
-                    textures.push_back(loadedTextures[j]);
-                    skip = true;
+                    known = true;
                     break;
                 }
             }
-            if (!skip)
+            if (known)
+                continue;
+
+            TextureRef ref = refs[t];
+
+            PendingTexture request;
+            request.path = ref.path;
+            const MappedFile* model = &source;
+            request.image = ThreadPool::Shared().Submit([directory, model, ref, gamma]() { return decodeTexture(directory, *model, ref, gamma); });
+            pending.push_back(std::move(request));
+        }
+    }
+
+    // Runs on a worker thread
+    static TextureData decodeTexture(const std::string& directory, const MappedFile& model, const TextureRef& ref, bool gamma)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        TextureData image;
+        image.ref = ref;
+
+        // Encoded bytes : a range of the mapped model file for embedded textures, otherwise the mapped image file.
+        // Textures decoded during import hash and build from their pixels.
+        MappedFile file;
+        const unsigned char* encoded = nullptr;
+        std::size_t encodedSize = 0;
+
+        if (ref.decoded)
+        {
+            encoded = ref.decoded->pixels.data();
+            encodedSize = ref.decoded->pixels.size();
+        }
+        else if (ref.embeddedSize != 0)
+        {
+            if (model.IsOpen() && ref.embeddedOffset + ref.embeddedSize <= model.Size())
+            {
+                encoded = model.Data() + ref.embeddedOffset;
+                encodedSize = static_cast<std::size_t>(ref.embeddedSize);
+            }
+        }
+        else if (file.Open(directory + '/' + ref.path))
+        {
+            encoded = file.Data();
+            encodedSize = file.Size();
+        }
+
+        if (encoded)
+        {
+            image.contentHash = CompressedTexture::ContentKey(encoded, encodedSize, gamma);
+
+            // Another model already uploaded these exact bytes
+            if (AssetRegistry::Get().HasTexture(image.contentHash))
+            {
+                image.decodeSkipped = true;
+                return image;
+            }
+
+            // Baked or previously encoded blocks are used as they are
+            std::string compressedPath = CompressedTexture::CachePath(directory, image.contentHash);
+            if (CompressedTexture::Enabled())
             {
-                std::string texturePath = str.C_Str();
-                if (texturePath == "*0") {
-                    texturePath = defaultTexturePath; // Use the default texture path
+                image.compressed.reset(new CompressedTexture());
+                if (image.compressed->Open(compressedPath, image.contentHash))
+                {
+                    image.width = static_cast<int>(image.compressed->width);
+                    image.height = static_cast<int>(image.compressed->height);
+                    image.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+                    return image;
                 }
+                image.compressed.reset();
+            }
 
-                Texture texture;
-                texture.ID = loadTexture(texturePath.c_str(), this->directory, gammaCorrection);
-                texture.type = typeName;
-                texture.path = texturePath;
-                textures.push_back(texture);
-                loadedTextures.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+            const unsigned char* pixels = nullptr;
+            unsigned char* loaded = nullptr;
+            if (ref.decoded)
+            {
+                pixels = ref.decoded->pixels.data();
+                image.width = ref.decoded->width;
+                image.height = ref.decoded->height;
+                image.components = ref.decoded->components;
+            }
+            else
+            {
+                loaded = stbi_load_from_memory(encoded, static_cast<int>(encodedSize), &image.width, &image.height, &image.components, 0);
+                pixels = loaded;
+            }
+
+            if (pixels)
+            {
+                // Already on a pool worker, so the encode stays on this thread
+                if (CompressedTexture::Enabled())
+                {
+                    image.compressed = CompressedTexture::Compress(pixels, image.width, image.height, image.components, gamma);
+                    if (!image.compressed->Write(compressedPath, image.contentHash))
+                        std::cout << "ERROR::BCTEX:: Failed to write " << compressedPath << std::endl;
+                }
+                else
+                {
+                    image.mips = MipChain::Build(pixels, image.width, image.height, image.components, gamma);
+                }
+                if (loaded)
+                    stbi_image_free(loaded);
             }
         }
-        return textures;
+
+        if (!image.Loaded())
+            std::cout << "Texture failed to load at path: " << ref.path << std::endl;
+
+        image.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return image;
     }
 
-    unsigned int loadTexture(const char* path, const std::string& directory, bool gamma)
+    void acquireTextures(ModelData& data)
     {
-        std::string filename = std::string(path);
-        filename = directory + '/' + filename;
-        
-        std::cout << filename << std::endl;
+        std::vector<GLuint> textureIDs;
+        for (unsigned int i = 0; i < data.textures.size(); i++)
+        {
+            TextureData& image = data.textures[i];
 
-        unsigned int textureID;
-        glGenTextures(1, &textureID);
+            Texture texture;
+            texture.ID = AssetRegistry::Get().AcquireTexture(image.contentHash, &texture.gpuBytes);
+            texture.type = image.ref.type;
+            texture.path = image.ref.path;
+            texture.contentHash = image.contentHash;
+
+            image.reused = texture.ID != 0;
+            if (!image.reused)
+                textureIDs.push_back(0);
+
+            loadedTextures.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+        }
 
-        int width, height, nrComponents;
-        unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-        
-        if (data)
+        if (textureIDs.empty())
+            return;
+
+        glGenTextures(static_cast<GLsizei>(textureIDs.size()), textureIDs.data());
+
+        unsigned int next = 0;
+        for (unsigned int i = 0; i < loadedTextures.size(); i++)
         {
-            GLenum format;
-            if (nrComponents == 1)
-                format = GL_RED;
-            else if (nrComponents == 3)
-                format = GL_RGB;
-            else if (nrComponents == 4)
-                format = GL_RGBA;
+            if (!data.textures[i].reused)
+                loadedTextures[i].ID = textureIDs[next++];
+        }
+    }
+
+    Texture findTexture(const TextureRef& ref) const
+    {
+        for (unsigned int j = 0; j < loadedTextures.size(); j++)
+        {
+            if (loadedTextures[j].path == ref.path)
+            {
+                Texture texture = loadedTextures[j];
+                texture.type = ref.type;
+                return texture;
+            }
+        }
+
+        Texture missing;
+        missing.ID = 0;
+        missing.type = ref.type;
+        missing.path = ref.path;
+        missing.contentHash = 0;
+        return missing;
+    }
+
+    // Time of a step that stopped partway through its texture or mesh
+    bool continueStep(std::chrono::high_resolution_clock::time_point start)
+    {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        itemUploadMs += ms;
+        uploadMs += ms;
+        return false;
+    }
 
-            glBindTexture(GL_TEXTURE_2D, textureID);
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            glGenerateMipmap(GL_TEXTURE_2D);
+    static void pixelFormats(int components, bool gamma, GLenum& format, GLenum& internalFormat)
+    {
+        format = GL_RGBA;
+        internalFormat = gamma ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+        if (components == 1)
+        {
+            format = GL_RED;
+            internalFormat = GL_R8;
+        }
+        else if (components == 2)
+        {
+            format = GL_RG;
+            internalFormat = GL_RG8;
+        }
+        else if (components == 3)
+        {
+            format = GL_RGB;
+            internalFormat = gamma ? GL_SRGB8 : GL_RGB8;
+        }
+    }
 
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Immutable storage for every level the worker built, filled afterwards by uploadTexture
+    static void allocateTexture(GLuint textureID, const TextureData& image, bool gamma)
+    {
+        if (!image.Loaded())
+            return;
 
-            stbi_image_free(data);
+        GLState::Get().BindTexture(0, textureID);
+        if (image.compressed)
+        {
+            const CompressedTexture& texture = *image.compressed;
+            glTexStorage2D(GL_TEXTURE_2D, static_cast<GLsizei>(texture.levels.size()), texture.InternalFormat(), texture.width, texture.height);
         }
         else
         {
-            std::cout << "Texture failed to load at path: " << path << std::endl;
-            stbi_image_free(data);
+            GLenum format, internalFormat;
+            pixelFormats(image.components, gamma, format, internalFormat);
+            glTexStorage2D(GL_TEXTURE_2D, static_cast<GLsizei>(image.mips.size()), internalFormat, image.width, image.height);
+        }
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // Uploads rows (block rows when compressed) of the levels from level/row on, at least one and about maxBytes of them,
+    // and leaves level/row at the next one. True once every level is in, false while there is more or ring is stalled.
+    static bool uploadTexture(GLuint textureID, const TextureData& image, unsigned int& level, unsigned int& row, std::size_t maxBytes, UploadRing* ring)
+    {
+        if (!image.Loaded())
+            return true;
+
+        unsigned int levelCount = static_cast<unsigned int>(image.compressed ? image.compressed->levels.size() : image.mips.size());
+        GLenum format, internalFormat;
+        pixelFormats(image.components, false, format, internalFormat);
+
+        GLState::Get().BindTexture(0, textureID);
+
+        // Odd widths of 1-3 channel levels aren't 4-byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        while (level < levelCount && maxBytes > 0)
+        {
+            unsigned int width, height, rowCount;
+            std::size_t rowBytes;
+            const unsigned char* levelData;
+            if (image.compressed)
+            {
+                const CompressedTexture::Level& compressedLevel = image.compressed->levels[level];
+                width = compressedLevel.width;
+                height = compressedLevel.height;
+                rowCount = (height + 3) / 4;
+                rowBytes = static_cast<std::size_t>(compressedLevel.size) / rowCount;
+                levelData = image.compressed->LevelData(level);
+            }
+            else
+            {
+                const MipChain::Level& mip = image.mips[level];
+                width = mip.width;
+                height = mip.height;
+                rowCount = height;
+                rowBytes = static_cast<std::size_t>(width) * image.components;
+                levelData = mip.texels.data();
+            }
+
+            unsigned int rows = static_cast<unsigned int>(std::min<std::size_t>(rowCount - row, std::max<std::size_t>(1, maxBytes / rowBytes)));
+            std::size_t bytes = rows * rowBytes;
+            const unsigned char* source = levelData + row * rowBytes;
+
+            // From the ring when it has room, client memory without one or for chunks it can never hold
+            const void* pixels = source;
+            if (ring)
+            {
+                std::size_t staged = ring->Stage(source, bytes);
+                if (staged != UploadRing::INVALID)
+                {
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->Buffer());
+                    pixels = reinterpret_cast<const void*>(staged);
+                }
+                else if (ring->Stalled())
+                {
+                    break;
+                }
+            }
+
+            if (image.compressed)
+            {
+                unsigned int y = row * 4;
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, width, std::min(rows * 4, height - y), image.compressed->InternalFormat(), static_cast<GLsizei>(bytes), pixels);
+            }
+            else
+            {
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, row, width, rows, format, GL_UNSIGNED_BYTE, pixels);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            row += rows;
+            if (row == rowCount)
+            {
+                level++;
+                row = 0;
+            }
+            maxBytes -= std::min(maxBytes, bytes);
         }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
-        return textureID;
+        return level == levelCount;
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "model.h"
+
+// Reference to a model in a ModelStore, 8 bytes, copied freely by scene instances
+// The generation makes a handle to a released slot stale instead of pointing at whatever reused it.
+struct ModelHandle
+{
+	std::uint32_t index;
+	std::uint32_t generation;
+
+	ModelHandle() : index(0), generation(0) {}
+	ModelHandle(std::uint32_t index, std::uint32_t generation) : index(index), generation(generation) {}
+
+	bool operator==(const ModelHandle& other) const
+	{
+		return index == other.index && generation == other.generation;
+	}
+};
+
+// Owns the models a scene draws, each one loaded and deleted exactly once however many times it is placed
+// GL thread only, like Model itself.
+class ModelStore
+{
+public:
+	ModelStore() {}
+
+	ModelStore(const ModelStore&) = delete;
+	ModelStore& operator=(const ModelStore&) = delete;
+
+	// Streamed models can be added straight away, callers check IsResident before drawing
+	ModelHandle Add(const std::shared_ptr<Model>& model)
+	{
+		std::uint32_t index;
+		if (!freeSlots.empty())
+		{
+			index = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else
+		{
+			index = static_cast<std::uint32_t>(slots.size());
+			slots.push_back(Slot());
+		}
+
+		slots[index].model = model;
+		return ModelHandle(index, slots[index].generation);
+	}
+
+	// nullptr for stale handles
+	Model* Get(ModelHandle handle) const
+	{
+		if (handle.index >= slots.size() || slots[handle.index].generation != handle.generation)
+			return nullptr;
+		return slots[handle.index].model.get();
+	}
+
+	// Deletes the model's GL objects and invalidates every handle to it
+	void Release(ModelHandle handle)
+	{
+		if (!Get(handle))
+			return;
+
+		Slot& slot = slots[handle.index];
+		slot.model->Delete();
+		slot.model.reset();
+		slot.generation++;
+		freeSlots.push_back(handle.index);
+	}
+
+	// Call while the context is still current, nothing is released on destruction
+	void Clear()
+	{
+		for (std::uint32_t i = 0; i < slots.size(); i++)
+		{
+			if (slots[i].model)
+				Release(ModelHandle(i, slots[i].generation));
+		}
+	}
+
+	unsigned int Size() const
+	{
+		return static_cast<unsigned int>(slots.size() - freeSlots.size());
+	}
+private:
+	struct Slot
+	{
+		std::shared_ptr<Model> model;
+		std::uint32_t generation;
+
+		Slot() : generation(1) {}
+	};
+
+	std::vector<Slot> slots;
+	std::vector<std::uint32_t> freeSlots;
+};
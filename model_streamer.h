@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "model.h"
+
+// Loads models in the background and uploads them a chunk at a time on the GL thread
+// Load() returns a handle straight away; the model stays non-resident (and is skipped by Scene) until Update() finishes it.
+class ModelStreamer
+{
+public:
+	ModelStreamer() : stopping(false), queued(0)
+	{
+		worker = std::thread([this]() { workerLoop(); });
+	}
+
+	~ModelStreamer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			stopping = true;
+		}
+		jobCondition.notify_all();
+		worker.join();
+	}
+
+	ModelStreamer(const ModelStreamer&) = delete;
+	ModelStreamer& operator=(const ModelStreamer&) = delete;
+
+	std::shared_ptr<Model> Load(const std::string& path, const std::string& defaultTexPath = "texture.png", bool gamma = false, VertexFormat format = VertexFormat::Compact(), unsigned int meshSteps = MeshSteps_Default, VertexWelder::Tolerance weldTolerance = VertexWelder::Tolerance(), GeometryResidency residency = GeometryResidency::Drop)
+	{
+		Job job;
+		job.model = Model::Deferred(defaultTexPath, gamma, format, meshSteps, weldTolerance, residency);
+		job.path = path;
+
+		std::shared_ptr<Model> handle = job.model;
+		{
+			std::lock_guard<std::mutex> lock(jobMutex);
+			requests.push_back(std::move(job));
+			queued++;
+		}
+		jobCondition.notify_one();
+
+		return handle;
+	}
+
+	// GL thread, once per frame : uploads imported models in chunks of about CHUNK_BYTES, staged through the UploadRing,
+	// for as long as the next chunk is expected to fit in budgetMs (at least one chunk per call, so loads always progress).
+	// Stops early when the ring is full, the GPU frees it within a frame or two.
+	void Update(double budgetMs)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		UploadRing& ring = UploadRing::Get();
+		double elapsed = 0.0;
+		double slowestChunk = 0.0;
+
+		do
+		{
+			if (!uploading.model)
+			{
+				std::lock_guard<std::mutex> lock(jobMutex);
+				if (imported.empty())
+					break;
+
+				uploading = std::move(imported.front());
+				imported.pop_front();
+			}
+
+			if (uploading.model->UploadStep(*uploading.data, CHUNK_BYTES, &ring))
+			{
+				uploading = Job();
+
+				std::lock_guard<std::mutex> lock(jobMutex);
+				queued--;
+			}
+
+			double now = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			slowestChunk = std::max(slowestChunk, now - elapsed);
+			elapsed = now;
+		} while (!ring.Stalled() && elapsed + slowestChunk < budgetMs);
+
+		ring.Fence();
+	}
+
+	// Models requested but not resident yet
+	unsigned int Pending() const
+	{
+		std::lock_guard<std::mutex> lock(jobMutex);
+		return queued;
+	}
+private:
+	static const std::size_t CHUNK_BYTES = 256 * 1024;
+
+	struct Job
+	{
+		std::shared_ptr<Model> model;
+		std::string path;
+		std::unique_ptr<ModelData> data;
+	};
+
+	std::deque<Job> requests;
+	std::deque<Job> imported;
+	Job uploading;
+
+	mutable std::mutex jobMutex;
+	std::condition_variable jobCondition;
+	bool stopping;
+	unsigned int queued;
+
+	std::thread worker;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(jobMutex);
+				jobCondition.wait(lock, [this]() { return stopping || !requests.empty(); });
+				if (stopping)
+					return;
+
+				job = std::move(requests.front());
+				requests.pop_front();
+			}
+
+			job.data = Model::Import(job.path, job.model->defaultTexturePath, job.model->gammaCorrection, job.model->vertexFormat, job.model->meshSteps, job.model->weldTolerance, job.model->residency);
+
+			std::lock_guard<std::mutex> lock(jobMutex);
+			imported.push_back(std::move(job));
+		}
+	}
+};
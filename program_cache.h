@@ -0,0 +1,165 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "asset_registry.h"
+#include "mapped_file.h"
+
+// Linked program binaries cached on disk ("<key>.progbin" beside the shader sources)
+// Layout : Header | driver binary. The key covers both sources, the defines, the driver strings
+// and the binary formats it accepts, so a driver update simply misses instead of feeding it stale code.
+class ProgramCache
+{
+public:
+	static const std::uint32_t VERSION = 1;
+
+	struct Stats
+	{
+		unsigned int hits;
+		unsigned int misses;    // no file, or one written for another key
+		unsigned int rejected;  // the driver refused the binary, the program was compiled instead
+		unsigned int writes;
+	};
+
+	// GL thread. Drivers without binary formats (some Mesa setups) always compile.
+	static bool Supported()
+	{
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}
+
+	// GL thread, needs the context for the driver strings
+	static std::uint64_t Key(const std::string& vertexSource, const std::string& fragmentSource, const std::string& defines)
+	{
+		std::uint64_t key = AssetRegistry::Hash(vertexSource.data(), vertexSource.size());
+		key = AssetRegistry::Hash(fragmentSource.data(), fragmentSource.size(), key);
+		key = AssetRegistry::Hash(defines.data(), defines.size(), key);
+
+		const GLenum strings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			const char* value = reinterpret_cast<const char*>(glGetString(strings[i]));
+			if (value)
+				key = AssetRegistry::Hash(value, std::strlen(value), key);
+		}
+
+		GLint formatCount = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+		if (formatCount > 0)
+		{
+			std::vector<GLint> formats(formatCount);
+			glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+			key = AssetRegistry::Hash(formats.data(), formats.size() * sizeof(GLint), key);
+		}
+		return key;
+	}
+
+	static std::string CachePath(const std::string& directory, std::uint64_t key)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+		return directory + '/' + name + ".progbin";
+	}
+
+	// Hands the cached binary to a program created with glCreateProgram, false (a miss) when there is none for this key.
+	// The driver may restore it in the background : Accepted() tells whether it was taken.
+	static bool Submit(GLuint program, const std::string& cachePath, std::uint64_t key)
+	{
+		MappedFile file;
+		Header header;
+		if (!file.Open(cachePath) || file.Size() < sizeof(Header))
+		{
+			GetStats().misses++;
+			return false;
+		}
+
+		std::memcpy(&header, file.Data(), sizeof(Header));
+		if (std::memcmp(header.magic, "TSPB", 4) != 0 || header.version != VERSION || header.key != key || sizeof(Header) + static_cast<std::size_t>(header.length) > file.Size())
+		{
+			GetStats().misses++;
+			return false;
+		}
+
+		glProgramBinary(program, header.format, file.Data() + sizeof(Header), static_cast<GLsizei>(header.length));
+		return true;
+	}
+
+	// After Submit, waits for the driver if needed. False : rejected, nothing is left linked and the program has to be compiled.
+	static bool Accepted(GLuint program)
+	{
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE)
+		{
+			GetStats().rejected++;
+			return false;
+		}
+
+		GetStats().hits++;
+		return true;
+	}
+
+	// The program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+	static bool Write(GLuint program, const std::string& cachePath, std::uint64_t key)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return false;
+
+		std::vector<unsigned char> binary(length);
+		GLenum format = 0;
+		GLsizei written = 0;
+		glGetProgramBinary(program, length, &written, &format, binary.data());
+		if (written <= 0)
+			return false;
+
+		Header header;
+		std::memcpy(header.magic, "TSPB", 4);
+		header.version = VERSION;
+		header.format = format;
+		header.length = static_cast<std::uint32_t>(written);
+		header.key = key;
+
+		// Moved over the target once complete, a crash mid write never leaves a truncated binary for the next start
+		std::string tempPath = cachePath + ".tmp";
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		out.write(reinterpret_cast<const char*>(binary.data()), written);
+		out.close();
+		if (!out || !MoveFileReplacing(tempPath, cachePath))
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+
+		GetStats().writes++;
+		return true;
+	}
+
+	static Stats& GetStats()
+	{
+		static Stats stats = {};
+		return stats;
+	}
+private:
+	struct Header
+	{
+		char magic[4];
+		std::uint32_t version;
+		std::uint32_t format;  // GLenum from glGetProgramBinary
+		std::uint32_t length;
+		std::uint64_t key;
+	};
+};
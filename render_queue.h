@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "frame_arena.h"
+
+// How a RenderQueue's last Sort went
+struct RenderQueueStats
+{
+	unsigned int packets;
+	unsigned int radixPasses;  // byte passes run, 0 when the previous order was reused
+	unsigned int moves;        // insertion sort steps when it was
+	bool incremental;
+};
+
+// Draw packets of one frame ordered by a 64-bit key, lowest first. The caller packs whatever order it wants into the key
+// (Scene : pass, program, texture set, VAO, then depth).
+// The order is kept for the next frame : when the packets come back with keys that are still (nearly) in that order,
+// Sort only checks it with an insertion sort. Otherwise it runs an 8-bit LSD radix sort with its scratch in a FrameArena.
+// Equal keys stay in push order after a radix sort, in last frame's order after an incremental one.
+template <typename Packet>
+class RenderQueue
+{
+public:
+	RenderQueue() : stats() {}
+
+	// Outside the hot path : room for packetCount packets without touching the heap
+	void Reserve(std::size_t packetCount)
+	{
+		packets.reserve(packetCount);
+		keys.reserve(packetCount);
+		order.reserve(packetCount);
+	}
+
+	// Sort scratch taken from the arena for packetCount packets, for FrameArena::Reserve
+	static std::size_t ScratchBytes(std::size_t packetCount)
+	{
+		return 2 * packetCount * sizeof(Entry) + alignof(Entry);
+	}
+
+	void Clear()
+	{
+		packets.clear();
+		keys.clear();
+	}
+
+	void Push(std::uint64_t key, const Packet& packet)
+	{
+		keys.push_back(key);
+		packets.push_back(packet);
+	}
+
+	void Sort(FrameArena& arena)
+	{
+		unsigned int count = static_cast<unsigned int>(packets.size());
+		stats = RenderQueueStats();
+		stats.packets = count;
+
+		if (order.size() == count && count > 0 && insertionSort())
+		{
+			stats.incremental = true;
+			return;
+		}
+
+		radixSort(arena);
+	}
+
+	unsigned int Size() const
+	{
+		return static_cast<unsigned int>(packets.size());
+	}
+
+	// i-th packet in key order, after Sort
+	const Packet& operator[](unsigned int i) const
+	{
+		return packets[order[i]];
+	}
+
+	std::uint64_t Key(unsigned int i) const
+	{
+		return keys[order[i]];
+	}
+
+	const RenderQueueStats& LastSort() const
+	{
+		return stats;
+	}
+private:
+	struct Entry
+	{
+		std::uint64_t key;
+		std::uint32_t packet;
+	};
+
+	std::vector<Packet> packets;
+	std::vector<std::uint64_t> keys;
+	std::vector<std::uint32_t> order;  // packet indices in key order, left from the last Sort
+	RenderQueueStats stats;
+
+	// Sorts order in place starting from the last frame's permutation.
+	// Gives up (false, order left valid but unsorted) once the moves pass a budget linear in the packet count.
+	bool insertionSort()
+	{
+		unsigned int count = static_cast<unsigned int>(order.size());
+		unsigned int budget = count + 64;
+		for (unsigned int i = 1; i < count; i++)
+		{
+			std::uint32_t packet = order[i];
+			std::uint64_t key = keys[packet];
+			unsigned int j = i;
+			while (j > 0 && keys[order[j - 1]] > key)
+			{
+				order[j] = order[j - 1];
+				j--;
+				if (++stats.moves > budget)
+				{
+					order[j] = packet;
+					return false;
+				}
+			}
+			order[j] = packet;
+		}
+		return true;
+	}
+
+	void radixSort(FrameArena& arena)
+	{
+		unsigned int count = static_cast<unsigned int>(packets.size());
+		order.resize(count);
+		if (count == 0)
+			return;
+
+		Entry* source = arena.Allocate<Entry>(count);
+		Entry* target = arena.Allocate<Entry>(count);
+
+		// Histograms of all 8 bytes in one read of the keys
+		std::uint32_t histograms[8][256];
+		std::memset(histograms, 0, sizeof(histograms));
+		for (unsigned int i = 0; i < count; i++)
+		{
+			source[i].key = keys[i];
+			source[i].packet = i;
+			for (unsigned int byte = 0; byte < 8; byte++)
+				histograms[byte][(keys[i] >> (byte * 8)) & 0xFF]++;
+		}
+
+		for (unsigned int byte = 0; byte < 8; byte++)
+		{
+			std::uint32_t* histogram = histograms[byte];
+
+			// Every key shares this byte, the pass would only copy
+			if (histogram[(source[0].key >> (byte * 8)) & 0xFF] == count)
+				continue;
+
+			std::uint32_t offset = 0;
+			for (unsigned int bucket = 0; bucket < 256; bucket++)
+			{
+				std::uint32_t size = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += size;
+			}
+
+			for (unsigned int i = 0; i < count; i++)
+				target[histogram[(source[i].key >> (byte * 8)) & 0xFF]++] = source[i];
+
+			Entry* swap = source;
+			source = target;
+			target = swap;
+			stats.radixPasses++;
+		}
+
+		for (unsigned int i = 0; i < count; i++)
+			order[i] = source[i].packet;
+	}
+};
@@ -7,80 +7,730 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.h"
+#include "gl_state.h"
 #include "shader.h"
 
 #include "light_manager.h"
 #include "model.h"
+#include "model_store.h"
+#include "render_queue.h"
+#include "uniform_blocks.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+// Per-instance replacement for the material uniforms Scene used to hard-code
+struct InstanceMaterial
+{
+	glm::vec3 ambient;
+	float shininess;
+	bool toonMode;
+	bool outline;
+
+	InstanceMaterial() : ambient(0.1f, 0.1f, 0.1f), shininess(32.0f), toonMode(true), outline(true) {}
+};
+
+// One placement of a model : the handle and what differs per placement, no geometry
+struct SceneInstance
+{
+	ModelHandle model;
+	glm::mat4 transform;
+	InstanceMaterial material;
+};
 
 class Scene
 {
 public:
-	std::vector<Model> objects;
-	std::vector<glm::vec3> transforms;
+	ModelStore& store;
+	std::vector<SceneInstance> instances;
 
 	LightManager& lightManager;
 
-	Scene(LightManager& lm) : lightManager(lm) {}
+	// Screen-space error allowed when picking a LOD, in pixels. Outlines are a thin band, they get away with more.
+	float lodPixelError;
+	float outlineLodPixelError;
+
+	// false : an outline is only hidden inside its own instance's silhouette and still shows over other objects in front of it.
+	// true : one stencil for the whole scene, outlines never cross any fill. Cheaper without GL_ARB_shader_stencil_export.
+	bool sharedOutlineStencil;
+
+	// Placements of one model with the same outline and toon settings are drawn as instanced commands once there are this many,
+	// culled per instance instead of per meshlet
+	unsigned int minInstancedGroup;
+
+	Scene(ModelStore& modelStore, LightManager& lm) : store(modelStore), lightManager(lm), lodPixelError(1.0f), outlineLodPixelError(3.0f), sharedOutlineStencil(false), minInstancedGroup(4), frameStats(),
+		groupsDirty(true), cameraBlock(CAMERA_BLOCK_BINDING), lastCamera(), cameraUploaded(false), objectBuffer(0), commandObjectBuffer(0), indirectBuffer(0), objectCapacity(0), commandCapacity(0) {}
 
-	void Add(Model newObject, glm::vec3 newTransform)
+	// Streamed models can be placed straight away, they are drawn once resident
+	unsigned int Add(ModelHandle model, const glm::mat4& transform, const InstanceMaterial& material = InstanceMaterial())
 	{
-		this->objects.push_back(newObject);
-		this->transforms.push_back(newTransform);
+		SceneInstance instance;
+		instance.model = model;
+		instance.transform = transform;
+		instance.material = material;
+		instances.push_back(instance);
+		groupsDirty = true;
+		return static_cast<unsigned int>(instances.size() - 1);
 	}
 
-	void Render(glm::mat4 projMatrix, glm::mat4 viewMatrix, glm::vec3 camPos, Shader& objectShader, Shader& outlineShader) const
+	// Call after changing an instance's model, material.outline or material.toonMode in place, they decide its instancing group
+	void Regroup()
 	{
-		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		groupsDirty = true;
+	}
+
+	// Registers the model in the store and places it once, tilted like every object before instances existed
+	ModelHandle Add(const std::shared_ptr<Model>& newObject, glm::vec3 position)
+	{
+		ModelHandle handle = store.Add(newObject);
+
+		float angle = 20.0f * instances.size();
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+		transform = glm::rotate(transform, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+
+		Add(handle, transform);
+		return handle;
+	}
+
+	// GL thread, once per frame before Render : sizes the per-frame draw lists for every resident instance,
+	// so Render doesn't touch the heap once a model has finished streaming in
+	void Prepare()
+	{
+		regroup();
 
-		for (unsigned int i = 0; i < objects.size(); i++)
+		unsigned int objects = 0;
+		unsigned int ranges = 0;
+		for (unsigned int i = 0; i < instances.size(); i++)
 		{
-			float angle = 20.0f * i;
+			const Model* placed = store.Get(instances[i].model);
+			if (!placed || !placed->IsResident())
+				continue;
 
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, this->transforms[i]);
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+			// Instanced groups write a DrawObject per pass and a command per LOD at most
+			for (unsigned int m = 0; m < placed->meshes.size(); m++)
+			{
+				objects += 2;
+				ranges += static_cast<unsigned int>(std::max<std::size_t>(placed->meshes[m].MaxRanges(), placed->meshes[m].lods.size()));
+			}
+		}
 
-			// 1st Pass : Phong Shading
-			glStencilFunc(GL_ALWAYS, 1, 0xFF);
-			glStencilMask(0xFF);
-			glEnable(GL_CULL_FACE);
-			glCullFace(GL_BACK);
+		drawObjects.reserve(objects);
+		visibleInstances.reserve(instances.size());
+		drawQueue.Reserve(ranges * 2);
+		frameArena.Reserve(RenderQueue<PendingDraw>::ScratchBytes(ranges * 2));
+		commands.reserve(ranges * 2);
+		commandObjects.reserve(ranges * 2);
+		fillBatches.reserve(ranges);
+		outlineBatches.reserve(ranges);
+		reserveBuffers(objects, ranges * 2);
+	}
 
-			objectShader.Use();
+	// Draws of both passes go through one RenderQueue, ordered by pass, program, texture set, VAO and then front to back.
+	// Each pass goes out as one glMultiDrawElementsIndirect per geometry pool and texture set,
+	// transforms, decode constants and materials are read by the shaders from SSBOs (see phong_light_tex.vert).
+	// Large groups of one model become instanced commands, one per mesh and LOD.
+	// toonShader and plainShader are the TOON_EDGES on and off permutations of the fill program, picked per instance by material.toonMode.
+	void Render(const glm::mat4& projMatrix, const glm::mat4& viewMatrix, const glm::vec3& camPos, const Shader& toonShader, const Shader& plainShader, const Shader& outlineShader) const
+	{
+		frameStats = MeshletStats();
+		if (!toonShader.IsReady() && !plainShader.IsReady())
+			return; // Still compiling (see ShaderManager)
+
+		// Model units per pixel at distance 1, for turning the pixel thresholds into LOD errors
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		float unitsPerPixel = 2.0f / (projMatrix[1][1] * std::max(viewport[3], 1));
+
+		regroup();
+
+		drawObjects.clear();
+		drawQueue.Clear();
+		frameArena.Reset();
+
+		// World space frustum, for culling whole instances
+		MeshletCull frustum = MeshletCull::FromMatrices(projMatrix, viewMatrix, glm::mat4(1.0f), camPos, false);
+
+		for (unsigned int g = 0; g < groups.size(); g++)
+		{
+			const InstanceGroup& group = groups[g];
+			const Model* placed = store.Get(instances[groupedInstances[group.first]].model);
+			if (!placed || !placed->IsResident())
+				continue; // Placeholder : draw nothing until the upload is done
+
+			if (group.count >= minInstancedGroup)
+			{
+				appendInstanced(group, *placed, frustum, unitsPerPixel, camPos);
+				continue;
+			}
+
+			for (unsigned int i = group.first; i < group.first + group.count; i++)
+				appendCulled(instances[groupedInstances[i]], *placed, unitsPerPixel, projMatrix, viewMatrix, camPos);
+		}
 
-			objectShader.SetMat4("projection", projMatrix);
-			objectShader.SetMat4("view", viewMatrix);
-			objectShader.SetMat4("model", model);
+		drawQueue.Sort(frameArena);
 
-			objectShader.SetVec3("material.ambient", glm::vec3(0.1f, 0.1f, 0.1f));
-			objectShader.SetFloat("material.shininess", 32.0f);
+		// Outline draws sort after the fill pass (see drawKey)
+		unsigned int firstOutline = 0;
+		while (firstOutline < drawQueue.Size() && (drawQueue.Key(firstOutline) >> PASS_SHIFT) == FILL_PASS)
+			firstOutline++;
 
-			lightManager.Use(objectShader);
+		commands.clear();
+		commandObjects.clear();
+		buildBatches(0, firstOutline, true, fillBatches);
+		buildBatches(firstOutline, drawQueue.Size(), false, outlineBatches);
+		if (commands.empty())
+			return;
 
-			objectShader.SetVec3("viewPos", camPos);
-			objectShader.SetBool("toonMode", true);
+		reserveBuffers(static_cast<unsigned int>(drawObjects.size()), static_cast<unsigned int>(commands.size()));
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, drawObjects.size() * sizeof(DrawObject), drawObjects.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandObjectBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commandObjects.size() * sizeof(GLuint), commandObjects.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
 
-			static_cast<Model>(this->objects[i]).Draw(objectShader);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandObjectBuffer);
 
-			glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-			glStencilMask(0x00);  // Enable stencil writing
-			glCullFace(GL_FRONT);
+		// Camera and lights for both passes, shared by every program through their uniform blocks
+		CameraBlock camera = {};
+		camera.projection = projMatrix;
+		camera.view = viewMatrix;
+		camera.viewPos = camPos;
+		if (!cameraUploaded || std::memcmp(&camera, &lastCamera, sizeof(CameraBlock)) != 0)
+		{
+			cameraBlock.Update(camera);
+			lastCamera = camera;
+			cameraUploaded = true;
+		}
+		else
+		{
+			cameraBlock.Bind();
+		}
+		lightManager.Update();
+
+		// 1st Pass : Phong Shading, every instance marks the stencil with its own ref where the shader can export it, 1 otherwise
+		GLState& state = GLState::Get();
+		state.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		state.StencilFunc(GL_ALWAYS, 1, 0xFF);
+		state.StencilMask(0xFF);
+		state.Enable(GL_CULL_FACE);
+		state.CullFace(GL_BACK);
+
+		// Toon batches sort after the plain ones (see drawKey)
+		unsigned int firstToon = 0;
+		while (firstToon < fillBatches.size() && !fillBatches[firstToon].toon)
+			firstToon++;
+
+		if (plainShader.IsReady() && firstToon > 0)
+		{
+			plainShader.Use();
+			submit(plainShader, fillBatches, 0, firstToon, true);
+		}
+		if (toonShader.IsReady() && firstToon < fillBatches.size())
+		{
+			toonShader.Use();
+			submit(toonShader, fillBatches, firstToon, static_cast<unsigned int>(fillBatches.size()), true);
+		}
 
+		// 2nd Pass : outlines, outside their own instance's silhouette (outside every silhouette with sharedOutlineStencil)
+		if (!outlineBatches.empty() && outlineShader.IsReady())
+		{
 			outlineShader.Use();
 
-			model = glm::scale(model, glm::vec3(lightManager.outlineScale));
-			outlineShader.SetMat4("projection", projMatrix);
-			outlineShader.SetMat4("view", viewMatrix);
-			outlineShader.SetMat4("model", model);
+			if (sharedOutlineStencil || stencilExport())
+			{
+				// The outline shader exports its instance's ref, the test passes wherever another instance (or nothing) was drawn
+				state.StencilFunc(GL_NOTEQUAL, 1, 0xFF);
+				state.StencilMask(0x00);  // Disable stencil writing
+				state.CullFace(GL_FRONT);
+
+				outlineShader.SetFloat(UNIFORM_ID("outlineScale"), lightManager.outlineScale);
+
+				submit(outlineShader, outlineBatches, 0, static_cast<unsigned int>(outlineBatches.size()), false);
+			}
+			else
+			{
+				// Every silhouette holds 1 : per batch, clear the stencil and mark the batch's own silhouettes again with the unscaled
+				// hull (no color, and no depth test so hidden parts count too), then draw the outline depth tested against the fill.
+				// Instances sharing a batch still hide each other's outlines.
+				for (unsigned int i = 0; i < outlineBatches.size(); i++)
+				{
+					state.StencilMask(0xFF);
+					glClear(GL_STENCIL_BUFFER_BIT);
+					state.StencilFunc(GL_ALWAYS, 1, 0xFF);
+					state.CullFace(GL_BACK);
+					state.Disable(GL_DEPTH_TEST);
+					glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+					outlineShader.SetFloat(UNIFORM_ID("outlineScale"), 1.0f);
+					submit(outlineShader, outlineBatches, i, i + 1, false);
+
+					glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+					state.Enable(GL_DEPTH_TEST);
+					state.StencilFunc(GL_NOTEQUAL, 1, 0xFF);
+					state.StencilMask(0x00);
+					state.CullFace(GL_FRONT);
+
+					outlineShader.SetFloat(UNIFORM_ID("outlineScale"), lightManager.outlineScale);
+					submit(outlineShader, outlineBatches, i, i + 1, false);
+				}
+			}
+		}
+
+		// Left as the rest of the frame expects it, the tracker makes this free when nothing changed
+		state.StencilFunc(GL_ALWAYS, 1, 0xFF);
+		state.StencilMask(0xFF);
+		state.CullFace(GL_BACK);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// Call while the context is still current
+	void Delete()
+	{
+		cameraBlock.Delete();
+		cameraUploaded = false;
+		glDeleteBuffers(1, &objectBuffer);
+		glDeleteBuffers(1, &commandObjectBuffer);
+		glDeleteBuffers(1, &indirectBuffer);
+		objectBuffer = commandObjectBuffer = indirectBuffer = 0;
+		objectCapacity = commandCapacity = 0;
+	}
+
+	// Meshlets and triangles of the last Render, both passes. draws counts indirect calls.
+	const MeshletStats& Stats() const
+	{
+		return frameStats;
+	}
+
+	// How the last Render ordered its draws
+	const RenderQueueStats& QueueStats() const
+	{
+		return drawQueue.LastSort();
+	}
+private:
+	// Per mesh and instance, std430 layout of DrawObject in phong_light_tex.vert and outline.vert
+	struct DrawObject
+	{
+		glm::mat4 model;
+		glm::vec4 decodeOffset;
+		glm::vec4 decodeScale;
+		glm::vec4 material;  // ambient, shininess
+		glm::uvec4 flags;    // x : toonMode, y : stencil ref
+	};
+
+	// Layout fixed by glMultiDrawElementsIndirect
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;  // first DrawObject, read back through the arena's draw index attribute by shaders without gl_DrawID
+	};
+
+	// drawKey fields, most significant first : pass (2 bits) | program (4) | texture set (16) | geometry pool (10) | depth (32)
+	enum DrawPass
+	{
+		FILL_PASS = 0,
+		OUTLINE_PASS = 1
+	};
+
+	enum DrawProgram
+	{
+		PLAIN_PROGRAM = 0,
+		TOON_PROGRAM = 1,
+		OUTLINE_PROGRAM = 2
+	};
+
+	static const unsigned int PASS_SHIFT = 62;
+	static const unsigned int PROGRAM_SHIFT = 58;
+	static const unsigned int TEXTURES_SHIFT = 42;
+	static const unsigned int POOL_SHIFT = 32;
+
+	// Index range surviving the culling, queued under its drawKey before sorting into batches
+	struct PendingDraw
+	{
+		const Mesh* mesh;
+		unsigned int object;
+		unsigned int firstIndex;
+		unsigned int indexCount;
+		unsigned int instanceCount;  // consecutive DrawObjects starting at object
+	};
+
+	// Run of groupedInstances placing the same model with the same outline and toon settings
+	struct InstanceGroup
+	{
+		unsigned int first;
+		unsigned int count;
+	};
+
+	// Instance of an instanced group that passed the frustum test, with its LOD thresholds
+	struct VisibleInstance
+	{
+		const SceneInstance* instance;
+		float fillError;
+		float outlineError;
+		float depth;  // camera to bounding sphere center
+	};
+
+	// Consecutive commands sharing a VAO (and, in the first pass, textures and program)
+	struct Batch
+	{
+		const Mesh* mesh;
+		unsigned int first;
+		unsigned int count;
+		bool toon;
+	};
+
+	mutable MeshletStats frameStats;
+
+	// Instance indices sorted by model, outline and toon settings, rebuilt when groupsDirty
+	mutable std::vector<unsigned int> groupedInstances;
+	mutable std::vector<InstanceGroup> groups;
+	mutable bool groupsDirty;
+
+	// Rebuilt every Render, reserved by Prepare
+	mutable std::vector<VisibleInstance> visibleInstances;
+	mutable std::vector<DrawObject> drawObjects;
+	mutable RenderQueue<PendingDraw> drawQueue;
+	mutable FrameArena frameArena;  // sort scratch, reset every Render
+	mutable std::vector<DrawElementsIndirectCommand> commands;
+	mutable std::vector<GLuint> commandObjects;  // first DrawObject of each command, gl_InstanceID is added to it
+	mutable std::vector<Batch> fillBatches;
+	mutable std::vector<Batch> outlineBatches;
+
+	mutable UniformBlock<CameraBlock> cameraBlock;
+	mutable CameraBlock lastCamera;
+	mutable bool cameraUploaded;
+
+	mutable GLuint objectBuffer;
+	mutable GLuint commandObjectBuffer;
+	mutable GLuint indirectBuffer;
+	mutable unsigned int objectCapacity;
+	mutable unsigned int commandCapacity;
 
-			static_cast<Model>(this->objects[i]).Draw();
+	void regroup() const
+	{
+		if (!groupsDirty)
+			return;
+
+		groupedInstances.resize(instances.size());
+		for (unsigned int i = 0; i < instances.size(); i++)
+			groupedInstances[i] = i;
+
+		std::sort(groupedInstances.begin(), groupedInstances.end(), [this](unsigned int a, unsigned int b)
+		{
+			const SceneInstance& x = instances[a];
+			const SceneInstance& y = instances[b];
+			if (x.model.index != y.model.index)
+				return x.model.index < y.model.index;
+			if (x.model.generation != y.model.generation)
+				return x.model.generation < y.model.generation;
+			if (x.material.outline != y.material.outline)
+				return x.material.outline < y.material.outline;
+			if (x.material.toonMode != y.material.toonMode)
+				return x.material.toonMode < y.material.toonMode;
+			return a < b;
+		});
+
+		groups.clear();
+		for (unsigned int i = 0; i < groupedInstances.size(); i++)
+		{
+			const SceneInstance& instance = instances[groupedInstances[i]];
+			if (!groups.empty())
+			{
+				const SceneInstance& previous = instances[groupedInstances[i - 1]];
+				if (previous.model == instance.model && previous.material.outline == instance.material.outline && previous.material.toonMode == instance.material.toonMode)
+				{
+					groups.back().count++;
+					continue;
+				}
+			}
+
+			InstanceGroup group = { i, 1 };
+			groups.push_back(group);
+		}
+		groupsDirty = false;
+	}
+
+	// Distance to the nearest point of the bounding sphere, scaled by the largest axis of the transform.
+	// LOD errors are in model units, so the world-space threshold is divided by the same scale.
+	static float lodDistance(const glm::mat4& model, const Model& object, const glm::vec3& camPos, glm::vec3& center, float& radius)
+	{
+		float scale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		center = glm::vec3(model * glm::vec4((object.BoundsMin() + object.BoundsMax()) * 0.5f, 1.0f));
+		radius = glm::length(object.BoundsMax() - object.BoundsMin()) * 0.5f * scale;
+		return std::max(glm::length(camPos - center) - radius, 0.01f) / std::max(scale, 1e-6f);
+	}
+
+	// GL_ARB_shader_stencil_export, which lets the fill and outline shaders use a ref per instance. Asked once, GL thread.
+	static bool stencilExport()
+	{
+		static const bool supported = []()
+		{
+			GLint extensionCount = 0;
+			glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+			for (GLint i = 0; i < extensionCount; i++)
+			{
+				const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+				if (name && std::strcmp(name, "GL_ARB_shader_stencil_export") == 0)
+					return true;
+			}
+			return false;
+		}();
+		return supported;
+	}
+
+	// 1 to 255 by instance index, so only instances 255 apart can hide each other's outlines. All 1 with sharedOutlineStencil.
+	unsigned int stencilRef(const SceneInstance& instance) const
+	{
+		if (sharedOutlineStencil)
+			return 1u;
+		return static_cast<unsigned int>(&instance - instances.data()) % 255u + 1u;
+	}
+
+	DrawObject makeDrawObject(const SceneInstance& instance, const Mesh& mesh) const
+	{
+		DrawObject drawObject;
+		drawObject.model = instance.transform;
+		drawObject.decodeOffset = mesh.decode.offset;
+		drawObject.decodeScale = glm::vec4(mesh.decode.scale, 0.0f);
+		drawObject.material = glm::vec4(instance.material.ambient, instance.material.shininess);
+		drawObject.flags = glm::uvec4(instance.material.toonMode ? 1u : 0u, stencilRef(instance), 0u, 0u);
+		return drawObject;
+	}
+
+	// One placement, meshlet culled : a DrawObject per mesh shared by both passes, a command per surviving range
+	void appendCulled(const SceneInstance& instance, const Model& object, float unitsPerPixel, const glm::mat4& projMatrix, const glm::mat4& viewMatrix, const glm::vec3& camPos) const
+	{
+		const glm::mat4& model = instance.transform;
+
+		glm::vec3 center;
+		float radius;
+		float distance = lodDistance(model, object, camPos, center, radius);
+		float depth = glm::length(camPos - center);
+
+		float fillError = lodPixelError * unitsPerPixel * distance;
+		float outlineError = outlineLodPixelError * unitsPerPixel * distance / lightManager.outlineScale;
+		MeshletCull fillCull = MeshletCull::FromMatrices(projMatrix, viewMatrix, model, camPos, false);
+		// Front faces are culled in the outline pass, so clusters facing the camera are the ones to drop
+		MeshletCull outlineCull = MeshletCull::FromMatrices(projMatrix, viewMatrix, glm::scale(model, glm::vec3(lightManager.outlineScale)), camPos, true);
+
+		for (unsigned int m = 0; m < object.meshes.size(); m++)
+		{
+			const Mesh& mesh = object.meshes[m];
+			unsigned int objectIndex = static_cast<unsigned int>(drawObjects.size());
+			drawObjects.push_back(makeDrawObject(instance, mesh));
+
+			std::uint64_t key = drawKey(FILL_PASS, instance.material.toonMode ? TOON_PROGRAM : PLAIN_PROGRAM, mesh, depth);
+			mesh.CollectRanges(mesh.SelectLod(fillError), fillCull, frameStats, [&](unsigned int firstIndex, unsigned int indexCount)
+			{
+				PendingDraw draw = { &mesh, objectIndex, firstIndex, indexCount, 1 };
+				drawQueue.Push(key, draw);
+			});
+
+			if (!instance.material.outline)
+				continue;
+
+			key = drawKey(OUTLINE_PASS, OUTLINE_PROGRAM, mesh, depth);
+			mesh.CollectRanges(mesh.SelectLod(outlineError), outlineCull, frameStats, [&](unsigned int firstIndex, unsigned int indexCount)
+			{
+				PendingDraw draw = { &mesh, objectIndex, firstIndex, indexCount, 1 };
+				drawQueue.Push(key, draw);
+			});
+		}
+	}
+
+	// Placements of one model drawn together : frustum culled per instance, then per mesh one instanced command
+	// for every LOD in use, its instances' DrawObjects written back to back
+	void appendInstanced(const InstanceGroup& group, const Model& object, const MeshletCull& frustum, float unitsPerPixel, const glm::vec3& camPos) const
+	{
+		visibleInstances.clear();
+		for (unsigned int i = group.first; i < group.first + group.count; i++)
+		{
+			const SceneInstance& instance = instances[groupedInstances[i]];
+
+			glm::vec3 center;
+			float radius;
+			float distance = lodDistance(instance.transform, object, camPos, center, radius);
+			if (!frustum.SphereVisible(center, radius * lightManager.outlineScale))
+				continue;
+
+			VisibleInstance visible;
+			visible.instance = &instance;
+			visible.fillError = lodPixelError * unitsPerPixel * distance;
+			visible.outlineError = outlineLodPixelError * unitsPerPixel * distance / lightManager.outlineScale;
+			visible.depth = glm::length(camPos - center);
+			visibleInstances.push_back(visible);
+		}
+		if (visibleInstances.empty())
+			return;
+
+		frameStats.instances += static_cast<unsigned int>(visibleInstances.size());
+		const InstanceMaterial& material = instances[groupedInstances[group.first]].material;
+		for (unsigned int m = 0; m < object.meshes.size(); m++)
+		{
+			const Mesh& mesh = object.meshes[m];
+			appendLodCommands(mesh, FILL_PASS, material.toonMode ? TOON_PROGRAM : PLAIN_PROGRAM);
+			if (material.outline)
+				appendLodCommands(mesh, OUTLINE_PASS, OUTLINE_PROGRAM);
+		}
+	}
+
+	// Each command is queued at the depth of its nearest instance
+	void appendLodCommands(const Mesh& mesh, DrawPass pass, DrawProgram program) const
+	{
+		const GeometryArena::Block& block = GeometryArena::Get().GetBlock(mesh.geometry);
+		for (unsigned int lod = 0; lod < mesh.lods.size(); lod++)
+		{
+			unsigned int firstObject = static_cast<unsigned int>(drawObjects.size());
+			float nearest = std::numeric_limits<float>::max();
+			for (unsigned int v = 0; v < visibleInstances.size(); v++)
+			{
+				const VisibleInstance& visible = visibleInstances[v];
+				if (mesh.SelectLod(pass == OUTLINE_PASS ? visible.outlineError : visible.fillError) != lod)
+					continue;
+				drawObjects.push_back(makeDrawObject(*visible.instance, mesh));
+				nearest = std::min(nearest, visible.depth);
+			}
+
+			unsigned int count = static_cast<unsigned int>(drawObjects.size()) - firstObject;
+			if (count == 0)
+				continue;
+
+			const MeshLod& level = mesh.lods[lod];
+			PendingDraw draw = { &mesh, firstObject, block.firstIndex + level.indexOffset, level.indexCount, count };
+			drawQueue.Push(drawKey(pass, program, mesh, nearest), draw);
+			frameStats.triangles += level.indexCount / 3 * count;
+		}
+	}
+
+	static bool sameTextures(const Mesh& a, const Mesh& b)
+	{
+		if (a.textures.size() != b.textures.size())
+			return false;
+		for (unsigned int i = 0; i < a.textures.size(); i++)
+		{
+			if (a.textures[i].ID != b.textures[i].ID)
+				return false;
+		}
+		return true;
+	}
+
+	static bool sameBatch(const Mesh& a, const Mesh& b, bool withTextures)
+	{
+		const GeometryArena& arena = GeometryArena::Get();
+		if (arena.GetBlock(a.geometry).pool != arena.GetBlock(b.geometry).pool)
+			return false;
+		return !withTextures || sameTextures(a, b);
+	}
+
+	// Sort key of a draw : pass, program, texture set, geometry pool, then camera distance so every batch draws front to back.
+	// Texture sets are folded to a 16-bit hash and pools to 10 bits, collisions only split batches.
+	static std::uint64_t drawKey(DrawPass pass, DrawProgram program, const Mesh& mesh, float depth)
+	{
+		std::uint64_t textures = 0;
+		if (pass == FILL_PASS)
+		{
+			std::uint64_t hash = AssetRegistry::Hash(nullptr, 0);
+			for (unsigned int i = 0; i < mesh.textures.size(); i++)
+				hash = AssetRegistry::Hash(&mesh.textures[i].ID, sizeof(GLuint), hash);
+			textures = (hash ^ (hash >> 16) ^ (hash >> 32) ^ (hash >> 48)) & 0xFFFF;
+		}
+		std::uint64_t pool = GeometryArena::Get().GetBlock(mesh.geometry).pool & 0x3FF;
 
-			glStencilFunc(GL_ALWAYS, 1, 0xFF);
-			glStencilMask(0xFF);
+		// Non-negative floats order like their bit patterns
+		float distance = std::max(depth, 0.0f);
+		std::uint32_t depthBits;
+		std::memcpy(&depthBits, &distance, sizeof(depthBits));
 
-			glCullFace(GL_BACK);
+		return (static_cast<std::uint64_t>(pass) << PASS_SHIFT) | (static_cast<std::uint64_t>(program) << PROGRAM_SHIFT) | (textures << TEXTURES_SHIFT) | (pool << POOL_SHIFT) | depthBits;
+	}
+
+	// Appends the sorted draws [begin, end) of one pass to commands, one Batch per run of the same program, VAO and textures
+	void buildBatches(unsigned int begin, unsigned int end, bool withTextures, std::vector<Batch>& batches) const
+	{
+		batches.clear();
+		for (unsigned int i = begin; i < end; i++)
+		{
+			const PendingDraw& draw = drawQueue[i];
+			bool toon = ((drawQueue.Key(i) >> PROGRAM_SHIFT) & 0xF) == TOON_PROGRAM;
+			if (batches.empty() || batches.back().toon != toon || !sameBatch(*batches.back().mesh, *draw.mesh, withTextures))
+			{
+				Batch batch = { draw.mesh, static_cast<unsigned int>(commands.size()), 0, toon };
+				batches.push_back(batch);
+			}
+
+			DrawElementsIndirectCommand command;
+			command.count = draw.indexCount;
+			command.instanceCount = draw.instanceCount;
+			command.firstIndex = draw.firstIndex;
+			command.baseVertex = GeometryArena::Get().GetBlock(draw.mesh->geometry).baseVertex;
+			command.baseInstance = draw.object;
+			commands.push_back(command);
+			commandObjects.push_back(draw.object);
+			batches.back().count++;
+		}
+	}
+
+	// batches[begin, end) with one program
+	void submit(const Shader& shader, const std::vector<Batch>& batches, unsigned int begin, unsigned int end, bool withTextures) const
+	{
+		const Mesh* boundTextures = nullptr;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			const Batch& batch = batches[i];
+			GLState::Get().BindVertexArray(GeometryArena::Get().VAO(GeometryArena::Get().GetBlock(batch.mesh->geometry).pool));
+			if (withTextures && (!boundTextures || !sameTextures(*boundTextures, *batch.mesh)))
+			{
+				batch.mesh->BindTextures(shader);
+				boundTextures = batch.mesh;
+			}
+
+			// gl_DrawID restarts at 0 for every call
+			shader.SetInt(UNIFORM_ID("drawBase"), static_cast<int>(batch.first));
+			glMultiDrawElementsIndirect(GL_TRIANGLES, batch.mesh->indexType, reinterpret_cast<const void*>(batch.first * sizeof(DrawElementsIndirectCommand)), static_cast<GLsizei>(batch.count), 0);
+			frameStats.draws++;
+		}
+	}
+
+	// Grows the SSBOs, the indirect buffer and the arena's draw index attribute, never shrinks them
+	void reserveBuffers(unsigned int objects, unsigned int drawCommands) const
+	{
+		if (objects > objectCapacity)
+		{
+			if (objectBuffer == 0)
+				glGenBuffers(1, &objectBuffer);
+			objectCapacity = std::max(objects, objectCapacity * 2);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, objectCapacity * sizeof(DrawObject), nullptr, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+			GeometryArena::Get().ReserveDrawIndices(objectCapacity);
+		}
+
+		if (drawCommands > commandCapacity)
+		{
+			if (commandObjectBuffer == 0)
+			{
+				glGenBuffers(1, &commandObjectBuffer);
+				glGenBuffers(1, &indirectBuffer);
+			}
+			commandCapacity = std::max(drawCommands, commandCapacity * 2);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandObjectBuffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, commandCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+			glBufferData(GL_DRAW_INDIRECT_BUFFER, commandCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 
-			glClear(GL_STENCIL_BUFFER_BIT);
 		}
 	}
 };
@@ -3,138 +3,419 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include "gl_state.h"
+#include "program_cache.h"
+#include "shader_preprocessor.h"
+
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile, not in the generated loader
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Index into a Shader's uniform table, from Shader::Uniform
+struct UniformHandle
+{
+	int index;  // -1 : not an active uniform of the program
+};
+
+// Uniform name hashed at compile time, see UNIFORM_ID
+struct UniformId
+{
+	std::uint32_t hash;
+};
+
+struct UniformStats
+{
+	unsigned long long issued;
+	unsigned long long skipped;  // same value as the last upload, no GL call
+};
 
 class Shader
 {
 public:
 	GLuint ID;
 
-	Shader(const char* vertexPath, const char* fragmentPath)
+	// deferred only submits the build and leaves it to Poll (see ShaderManager), otherwise the program is ready on return
+	Shader(const char* vertexPath, const char* fragmentPath, bool deferred = false) : Shader(vertexPath, fragmentPath, ShaderDefines(), deferred) {}
+
+	// One permutation of the sources : defines are injected after #version and #include is expanded (see ShaderPreprocessor)
+	Shader(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines, bool deferred = false) : stats(), fromCache(false), state(BuildState::Pending), cacheable(false), cacheKey(0), vID(0), fID(0)
 	{
-		// Get Source Code from File Path
-		std::string vertexSource;
-		std::string fragmentSource;
-		std::ifstream vertexShaderFile;
-		std::ifstream fragmentShaderFile;
+		bool loaded = ShaderPreprocessor::Load(vertexPath, defines, vertexSource, vertexFiles);
+		loaded = ShaderPreprocessor::Load(fragmentPath, defines, fragmentSource, fragmentFiles) && loaded;
 
-		vertexShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fragmentShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		ID = glCreateProgram();
 
-		try
+		// Unreadable source, the error has been printed : nothing to look up or compile
+		if (!loaded)
 		{
-			vertexShaderFile.open(vertexPath);
-			fragmentShaderFile.open(fragmentPath);
-			std::stringstream vertexShaderStream, fragmentShaderStream;
-
-			vertexShaderStream << vertexShaderFile.rdbuf();
-			fragmentShaderStream << fragmentShaderFile.rdbuf();
+			finish(false);
+			return;
+		}
 
-			vertexShaderFile.close();
-			fragmentShaderFile.close();
+		// A cached binary for these exact sources and this driver skips compiling altogether
+		cacheable = ProgramCache::Supported();
+		if (cacheable)
+		{
+			std::string directory(vertexPath);
+			std::size_t slash = directory.find_last_of("/\\");
+			directory = slash == std::string::npos ? "." : directory.substr(0, slash);
 
-			vertexSource = vertexShaderStream.str();
-			fragmentSource = fragmentShaderStream.str();
+			cacheKey = ProgramCache::Key(vertexSource, fragmentSource, defines.Key());
+			cachePath = ProgramCache::CachePath(directory, cacheKey);
+			fromCache = ProgramCache::Submit(ID, cachePath, cacheKey);
 		}
-		catch (std::ifstream::failure& e)
+
+		if (!fromCache)
+			submitSource();
+
+		if (!deferred)
+			Poll(false);
+	}
+
+	// Finishes a submitted build, true once the program can be used.
+	// completionQuery (parallel shader compile only) returns false while the driver is still busy instead of waiting for it.
+	bool Poll(bool completionQuery)
+	{
+		if (state != BuildState::Pending)
+			return state == BuildState::Ready;
+
+		if (completionQuery)
 		{
-			std::cout << "ERROR: Shader file not successfully read: " << e.what() << std::endl;
+			GLint done = GL_TRUE;
+			glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+			if (done != GL_TRUE)
+				return false;
 		}
 
-		const char* vertexShaderCode = vertexSource.c_str();
-		const char* fragmentShaderCode = fragmentSource.c_str();
-
-		// Shader Compilation
-		GLuint vID, fID;
-		vID = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vID, 1, &vertexShaderCode, NULL);
-		glCompileShader(vID);
-		checkCompileError(vID, "VERTEX");
+		if (fromCache)
+		{
+			if (ProgramCache::Accepted(ID))
+				return finish(true);
 
-		fID = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fID, 1, &fragmentShaderCode, NULL);
-		glCompileShader(fID);
-		checkCompileError(fID, "FRAGMENT");
+			// Rejected binary : compile after all, and come back for it
+			fromCache = false;
+			submitSource();
+			if (completionQuery)
+				return false;
+		}
 
-		ID = glCreateProgram();
-		glAttachShader(ID, vID);
-		glAttachShader(ID, fID);
-		glLinkProgram(ID);
-		checkCompileError(ID, "PROGRAM");
+		bool compiled = checkCompileError(vID, "VERTEX", vertexFiles);
+		compiled = checkCompileError(fID, "FRAGMENT", fragmentFiles) && compiled;
+		bool linked = compiled && checkCompileError(ID, "PROGRAM");
 
+		glDetachShader(ID, vID);
+		glDetachShader(ID, fID);
 		glDeleteShader(vID);
 		glDeleteShader(fID);
+		vID = fID = 0;
+
+		if (cacheable && linked && !ProgramCache::Write(ID, cachePath, cacheKey))
+			std::cout << "ERROR::SHADER::PROGRAM_CACHE_WRITE_FAILED " << cachePath << std::endl;
+
+		return finish(linked);
+	}
+
+	bool IsReady() const
+	{
+		return state == BuildState::Ready;
+	}
+
+	// Source, compile or link errors were printed, the program never becomes ready
+	bool HasFailed() const
+	{
+		return state == BuildState::Failed;
 	}
 
 	void Use() const
 	{
-		glUseProgram(ID);
+		GLState::Get().UseProgram(ID);
 	}
 
 	void Delete() const
 	{
+		glDeleteShader(vID);
+		glDeleteShader(fID);
 		glDeleteProgram(ID);
+		GLState::Get().ProgramDeleted(ID);
+	}
+
+	// Restored from the ProgramCache instead of compiled
+	bool FromCache() const
+	{
+		return fromCache;
+	}
+
+	// FNV-1a of a uniform name, usable in constant expressions (see UNIFORM_ID)
+	static constexpr std::uint32_t Hash(const char* name)
+	{
+		std::uint32_t hash = 2166136261u;
+		for (; *name; name++)
+		{
+			hash ^= static_cast<unsigned char>(*name);
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	// Stable for the program's lifetime, an invalid handle (inactive or unknown uniform) makes the Set* calls no-ops
+	UniformHandle Uniform(UniformId id) const
+	{
+		std::vector<UniformInfo>::const_iterator it = std::lower_bound(uniforms.begin(), uniforms.end(), id.hash, [](const UniformInfo& info, std::uint32_t hash) { return info.hash < hash; });
+		UniformHandle handle;
+		handle.index = it != uniforms.end() && it->hash == id.hash ? static_cast<int>(it - uniforms.begin()) : -1;
+		return handle;
+	}
+
+	UniformHandle Uniform(const char* name) const
+	{
+		UniformId id = { Hash(name) };
+		return Uniform(id);
+	}
+
+	// Uploads since the program was linked, skipped ones matched the value the location already held
+	const UniformStats& Stats() const
+	{
+		return stats;
+	}
+
+	// Every Shader's counters together
+	static UniformStats& TotalStats()
+	{
+		static UniformStats totals = {};
+		return totals;
 	}
 
-	void SetBool(const std::string& name, bool value) const
+	// Uniforms are taken by name, UNIFORM_ID or UniformHandle. The program must be in use, as with glUniform.
+	template <typename Key>
+	void SetBool(Key key, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		int data = value ? 1 : 0;
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &data, sizeof(data)))
+			glUniform1i(location(handle), data);
 	}
 
-	void SetInt(const std::string& name, int value) const
+	template <typename Key>
+	void SetInt(Key key, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &value, sizeof(value)))
+			glUniform1i(location(handle), value);
 	}
 
-	void SetFloat(const std::string& name, float value) const
+	template <typename Key>
+	void SetFloat(Key key, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &value, sizeof(value)))
+			glUniform1f(location(handle), value);
 	}
 
-	void SetVec2(const std::string& name, glm::vec2 &value) const
+	template <typename Key>
+	void SetVec2(Key key, const glm::vec2& value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &value[0], sizeof(value)))
+			glUniform2fv(location(handle), 1, &value[0]);
 	}
 
-	void SetVec2(const std::string& name, float x, float y) const
+	template <typename Key>
+	void SetVec2(Key key, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		SetVec2(key, glm::vec2(x, y));
 	}
 
-	void SetVec3(const std::string& name, const glm::vec3& value) const
+	template <typename Key>
+	void SetVec3(Key key, const glm::vec3& value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &value[0], sizeof(value)))
+			glUniform3fv(location(handle), 1, &value[0]);
 	}
 
-	void SetVec3(const std::string& name, float x, float y, float z) const
+	template <typename Key>
+	void SetVec3(Key key, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		SetVec3(key, glm::vec3(x, y, z));
 	}
 
-	void SetVec4(const std::string& name, const glm::vec4& value) const
+	template <typename Key>
+	void SetVec4(Key key, const glm::vec4& value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &value[0], sizeof(value)))
+			glUniform4fv(location(handle), 1, &value[0]);
 	}
 
-	void SetVec4(const std::string& name, float x, float y, float z, float w) const
+	template <typename Key>
+	void SetVec4(Key key, float x, float y, float z, float w) const
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		SetVec4(key, glm::vec4(x, y, z, w));
 	}
 
-	void SetMat3(const std::string& name, const glm::mat3& mat) const
+	template <typename Key>
+	void SetMat3(Key key, const glm::mat3& mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &mat[0][0], sizeof(mat)))
+			glUniformMatrix3fv(location(handle), 1, GL_FALSE, &mat[0][0]);
 	}
 
-	void SetMat4(const std::string& name, const glm::mat4& mat) const
+	template <typename Key>
+	void SetMat4(Key key, const glm::mat4& mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		UniformHandle handle = resolve(key);
+		if (changed(handle, &mat[0][0], sizeof(mat)))
+			glUniformMatrix4fv(location(handle), 1, GL_FALSE, &mat[0][0]);
 	}
 private:
-	void checkCompileError(GLuint shader, std::string type) {
+	// One active uniform (array elements get an entry each), sorted by hash
+	struct UniformInfo
+	{
+		std::uint32_t hash;
+		GLint location;
+		bool cached;
+		unsigned char value[sizeof(glm::mat4)];  // last upload, compared before the next
+	};
+
+	mutable std::vector<UniformInfo> uniforms;
+	mutable UniformStats stats;
+	bool fromCache;
+
+	enum class BuildState
+	{
+		Pending,
+		Ready,
+		Failed
+	};
+
+	BuildState state;
+	bool cacheable;
+	std::uint64_t cacheKey;
+	std::string cachePath;
+	std::string vertexSource;    // kept until the build is finished, a rejected binary falls back to them
+	std::string fragmentSource;
+	std::vector<std::string> vertexFiles;  // source string numbers of the logs, see ShaderPreprocessor
+	std::vector<std::string> fragmentFiles;
+	GLuint vID, fID;
+
+	// Queues compiling and linking ID from source without asking for any status, so the driver is free to do it in the background
+	void submitSource()
+	{
+		const char* vertexShaderCode = vertexSource.c_str();
+		const char* fragmentShaderCode = fragmentSource.c_str();
+
+		// Shader Compilation
+		vID = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vID, 1, &vertexShaderCode, NULL);
+		glCompileShader(vID);
+
+		fID = glCreateShader(GL_FRAGMENT_SHADER);
+		glShaderSource(fID, 1, &fragmentShaderCode, NULL);
+		glCompileShader(fID);
+
+		glAttachShader(ID, vID);
+		glAttachShader(ID, fID);
+		if (cacheable)
+			glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(ID);
+	}
+
+	bool finish(bool linked)
+	{
+		state = linked ? BuildState::Ready : BuildState::Failed;
+		if (linked)
+			reflectUniforms();
+
+		std::string().swap(vertexSource);
+		std::string().swap(fragmentSource);
+		std::vector<std::string>().swap(vertexFiles);
+		std::vector<std::string>().swap(fragmentFiles);
+		return linked;
+	}
+
+	// Active uniforms of the linked program, queried once : names never reach the driver again
+	void reflectUniforms()
+	{
+		uniforms.clear();
+
+		GLint count = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLchar name[256];
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, static_cast<GLuint>(i), sizeof(name), &length, &size, &type, name);
+
+			// Arrays are reported as "name[0]", each element is registered under its own name
+			std::string base(name, length);
+			if (size > 1 && base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0)
+				base.resize(base.size() - 3);
+
+			for (GLint element = 0; element < size; element++)
+			{
+				std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : base;
+				UniformInfo info = {};
+				info.hash = Hash(elementName.c_str());
+				info.location = glGetUniformLocation(ID, elementName.c_str());
+				if (info.location < 0)
+					continue; // uniform block member, set through its buffer
+				uniforms.push_back(info);
+			}
+		}
+
+		std::sort(uniforms.begin(), uniforms.end(), [](const UniformInfo& a, const UniformInfo& b) { return a.hash < b.hash; });
+		for (unsigned int i = 1; i < uniforms.size(); i++)
+		{
+			if (uniforms[i].hash == uniforms[i - 1].hash)
+				std::cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION at location " << uniforms[i].location << std::endl;
+		}
+	}
+
+	UniformHandle resolve(UniformHandle handle) const { return handle; }
+	UniformHandle resolve(UniformId id) const { return Uniform(id); }
+	UniformHandle resolve(const char* name) const { return Uniform(name); }
+
+	GLint location(UniformHandle handle) const
+	{
+		return uniforms[handle.index].location;
+	}
+
+	// Records the value and returns true when it differs from the last upload to this location
+	bool changed(UniformHandle handle, const void* data, std::size_t bytes) const
+	{
+		if (handle.index < 0)
+			return false;
+
+		UniformInfo& info = uniforms[handle.index];
+		if (info.cached && std::memcmp(info.value, data, bytes) == 0)
+		{
+			stats.skipped++;
+			TotalStats().skipped++;
+			return false;
+		}
+
+		std::memcpy(info.value, data, bytes);
+		info.cached = true;
+		stats.issued++;
+		TotalStats().issued++;
+		return true;
+	}
+
+	bool checkCompileError(GLuint shader, std::string type, const std::vector<std::string>& files = std::vector<std::string>()) {
 		GLint success;
 		GLchar infoLog[1024];
 
@@ -144,7 +425,10 @@ private:
 			if (!success)
 			{
 				glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-				std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
+				std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n" << infoLog;
+				for (unsigned int i = 0; i < files.size(); i++)
+					std::cout << "source " << i << " : " << files[i] << "\n";
+				std::cout << " -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
 		else
@@ -156,6 +440,9 @@ private:
 				std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
 			}
 		}
+		return success != 0;
 	}
 };
 
+// UniformId for a string literal, the hash is a compile-time constant : shader.SetVec3(UNIFORM_ID("viewPos"), position)
+#define UNIFORM_ID(name) (UniformId{ std::integral_constant<std::uint32_t, Shader::Hash(name)>::value })
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shader.h"
+
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile, not in the generated loader
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+
+// Owns the programs and builds them without stalling : every compile is submitted up front and finished from Update().
+// With parallel shader compile the driver builds them on its own threads and Update() only collects the finished ones,
+// without it Update() finishes one program per frame. Until a program is ready, whatever uses it draws nothing (see Scene::Render).
+class ShaderManager
+{
+public:
+	// proc : the context's loader (glfwGetProcAddress), for the extension entry points glad was not generated with
+	explicit ShaderManager(GLADloadproc proc) : parallel(false), reported(false), start(std::chrono::high_resolution_clock::now())
+	{
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount; i++)
+		{
+			const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, static_cast<GLuint>(i)));
+			if (name && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+				parallel = true;
+		}
+
+		if (!parallel)
+			return;
+
+		// As many compiler threads as the driver likes
+		typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+		MaxShaderCompilerThreadsProc maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(proc("glMaxShaderCompilerThreadsKHR"));
+		if (!maxShaderCompilerThreads)
+			maxShaderCompilerThreads = reinterpret_cast<MaxShaderCompilerThreadsProc>(proc("glMaxShaderCompilerThreadsARB"));
+		if (maxShaderCompilerThreads)
+			maxShaderCompilerThreads(0xFFFFFFFFu);
+	}
+
+	ShaderManager(const ShaderManager&) = delete;
+	ShaderManager& operator=(const ShaderManager&) = delete;
+
+	// One permutation of the sources, built on its first request : later requests for the same defines get the same Shader.
+	// The build is only submitted here, the Shader stays valid until Delete().
+	Shader& Load(const char* vertexPath, const char* fragmentPath, const ShaderDefines& defines = ShaderDefines())
+	{
+		std::string key = std::string(vertexPath) + '|' + fragmentPath + '|' + defines.Key();
+		std::unordered_map<std::string, unsigned int>::const_iterator found = variants.find(key);
+		if (found != variants.end())
+			return *shaders[found->second];
+
+		variants.emplace(key, static_cast<unsigned int>(shaders.size()));
+		if (reported)
+		{
+			// Variant requested after the startup ones were done, timed on its own
+			reported = false;
+			start = std::chrono::high_resolution_clock::now();
+		}
+		shaders.push_back(std::unique_ptr<Shader>(new Shader(vertexPath, fragmentPath, defines, true)));
+		return *shaders.back();
+	}
+
+	// GL thread, once per frame
+	void Update()
+	{
+		if (reported)
+			return;
+
+		for (unsigned int i = 0; i < shaders.size(); i++)
+		{
+			Shader& shader = *shaders[i];
+			if (shader.IsReady() || shader.HasFailed())
+				continue;
+
+			if (parallel)
+			{
+				shader.Poll(true);
+				continue;
+			}
+
+			shader.Poll(false);
+			break;
+		}
+
+		if (Pending() > 0)
+			return;
+
+		// Startup cost of the programs : a cold start compiles and fills the ProgramCache, a warm one only restores binaries
+		reported = true;
+		ProgramCache::Stats programStats = ProgramCache::GetStats();
+		std::cout << "Shaders : " << shaders.size() << " programs in " << std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() << " ms ("
+			<< (programStats.hits > 0 && programStats.misses + programStats.rejected == 0 ? "warm" : "cold") << " start, " << (parallel ? "parallel" : "one per frame") << ", "
+			<< programStats.hits << " cached, " << programStats.misses << " missed, " << programStats.rejected << " rejected)" << std::endl;
+	}
+
+	// Programs still building
+	unsigned int Pending() const
+	{
+		unsigned int pending = 0;
+		for (unsigned int i = 0; i < shaders.size(); i++)
+		{
+			if (!shaders[i]->IsReady() && !shaders[i]->HasFailed())
+				pending++;
+		}
+		return pending;
+	}
+
+	bool AllReady() const
+	{
+		return Pending() == 0;
+	}
+
+	bool Parallel() const
+	{
+		return parallel;
+	}
+
+	// Call while the context is still current
+	void Delete()
+	{
+		for (unsigned int i = 0; i < shaders.size(); i++)
+			shaders[i]->Delete();
+		shaders.clear();
+		variants.clear();
+	}
+private:
+	std::vector<std::unique_ptr<Shader>> shaders;
+	std::unordered_map<std::string, unsigned int> variants;  // "vertex|fragment|defines key" -> shaders index
+	bool parallel;
+	bool reported;
+	std::chrono::high_resolution_clock::time_point start;
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Compile-time switches of one shader permutation, injected as #define lines right after #version
+class ShaderDefines
+{
+public:
+	ShaderDefines& Set(const std::string& name, const std::string& value)
+	{
+		std::vector<std::pair<std::string, std::string>>::iterator it = std::lower_bound(values.begin(), values.end(), name,
+			[](const std::pair<std::string, std::string>& entry, const std::string& key) { return entry.first < key; });
+		if (it != values.end() && it->first == name)
+			it->second = value;
+		else
+			values.insert(it, std::make_pair(name, value));
+		return *this;
+	}
+
+	ShaderDefines& Set(const std::string& name, int value)
+	{
+		return Set(name, std::to_string(value));
+	}
+
+	// "NAME=VALUE;" sorted by name : the same switches give the same key whatever order they were set in
+	std::string Key() const
+	{
+		std::string key;
+		for (unsigned int i = 0; i < values.size(); i++)
+			key += values[i].first + '=' + values[i].second + ';';
+		return key;
+	}
+
+	std::string Directives() const
+	{
+		std::string directives;
+		for (unsigned int i = 0; i < values.size(); i++)
+			directives += "#define " + values[i].first + ' ' + values[i].second + '\n';
+		return directives;
+	}
+
+	bool Empty() const
+	{
+		return values.empty();
+	}
+private:
+	std::vector<std::pair<std::string, std::string>> values;  // sorted by name
+};
+
+// Expands #include "file" (relative to the including file, each file pasted once per program) and injects ShaderDefines.
+// Every pasted file gets its own source string number in #line, in the order files[] lists them : errors keep pointing at the right line.
+class ShaderPreprocessor
+{
+public:
+	static const unsigned int MAX_INCLUDE_DEPTH = 16;
+
+	// False when a file can't be read or includes nest too deep, the error has been printed
+	static bool Load(const std::string& path, const ShaderDefines& defines, std::string& source, std::vector<std::string>& files)
+	{
+		source.clear();
+		files.clear();
+		return expand(path, &defines, 0, source, files);
+	}
+private:
+	static bool expand(const std::string& path, const ShaderDefines* defines, unsigned int depth, std::string& source, std::vector<std::string>& files)
+	{
+		if (std::find(files.begin(), files.end(), path) != files.end())
+			return true;
+
+		if (depth > MAX_INCLUDE_DEPTH)
+		{
+			std::cout << "ERROR::SHADER::INCLUDE_TOO_DEEP " << path << std::endl;
+			return false;
+		}
+
+		std::ifstream file(path);
+		if (!file)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_READ " << path << std::endl;
+			return false;
+		}
+
+		unsigned int fileIndex = static_cast<unsigned int>(files.size());
+		files.push_back(path);
+		if (depth > 0)
+			source += "#line 1 " + std::to_string(fileIndex) + '\n';
+
+		std::string directory = path;
+		std::size_t slash = directory.find_last_of("/\\");
+		directory = slash == std::string::npos ? std::string() : directory.substr(0, slash + 1);
+
+		std::string line;
+		unsigned int lineNumber = 0;
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+			std::size_t start = line.find_first_not_of(" \t");
+			std::string directive = start == std::string::npos ? std::string() : line.substr(start);
+
+			if (directive.compare(0, 8, "#include") == 0)
+			{
+				std::size_t open = directive.find('"');
+				std::size_t close = open == std::string::npos ? std::string::npos : directive.find('"', open + 1);
+				if (close == std::string::npos)
+				{
+					std::cout << "ERROR::SHADER::BAD_INCLUDE " << path << ":" << lineNumber << std::endl;
+					return false;
+				}
+
+				if (!expand(directory + directive.substr(open + 1, close - open - 1), nullptr, depth + 1, source, files))
+					return false;
+				source += "#line " + std::to_string(lineNumber + 1) + ' ' + std::to_string(fileIndex) + '\n';
+				continue;
+			}
+
+			source += line;
+			source += '\n';
+
+			// Defines have to follow #version, which must come first
+			if (defines && !defines->Empty() && directive.compare(0, 8, "#version") == 0)
+			{
+				source += defines->Directives();
+				source += "#line " + std::to_string(lineNumber + 1) + ' ' + std::to_string(fileIndex) + '\n';
+			}
+		}
+		return true;
+	}
+};
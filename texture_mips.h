@@ -0,0 +1,173 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TOONSHADE_MIPS_SSE2
+#endif
+
+// Mip chain built on the CPU, level 0 first and down to 1x1
+// 2x2 box filter in integer math, so the SSE2 and scalar paths (and every machine) produce the same bytes.
+// With srgb set the color channels are averaged in linear space, alpha and 1-2 channel images always are linear.
+class MipChain
+{
+public:
+	struct Level
+	{
+		unsigned int width;
+		unsigned int height;
+		std::vector<unsigned char> texels;
+	};
+
+	static std::vector<Level> Build(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int components, bool srgb)
+	{
+		std::vector<Level> levels(1);
+		levels[0].width = width;
+		levels[0].height = height;
+		levels[0].texels.assign(pixels, pixels + static_cast<std::size_t>(width) * height * components);
+
+		bool linearColor = srgb && components >= 3;
+		while (levels.back().width > 1 || levels.back().height > 1)
+		{
+			const Level& src = levels.back();
+
+			Level dst;
+			dst.width = std::max(1u, src.width / 2);
+			dst.height = std::max(1u, src.height / 2);
+			dst.texels.resize(static_cast<std::size_t>(dst.width) * dst.height * components);
+
+			if (linearColor)
+				downsampleSRGB(src, dst, components);
+			else
+				downsample(src, dst, components);
+
+			levels.push_back(std::move(dst));
+		}
+
+		return levels;
+	}
+
+	// 1-4 components to RGBA8, grey for 1-2 channels, opaque when there's no alpha
+	static std::vector<unsigned char> ExpandRGBA(const unsigned char* pixels, unsigned int width, unsigned int height, unsigned int components)
+	{
+		std::vector<unsigned char> rgba(static_cast<std::size_t>(width) * height * 4);
+		for (std::size_t i = 0; i < static_cast<std::size_t>(width) * height; i++)
+		{
+			const unsigned char* src = pixels + i * components;
+			unsigned char* dst = &rgba[i * 4];
+			dst[0] = src[0];
+			dst[1] = components > 2 ? src[1] : src[0];
+			dst[2] = components > 2 ? src[2] : src[0];
+			dst[3] = components == 4 ? src[3] : (components == 2 ? src[1] : 255);
+		}
+		return rgba;
+	}
+private:
+	// 8-bit sRGB to 16-bit linear, and the midpoints between consecutive entries for the way back
+	struct SRGBTables
+	{
+		std::uint16_t toLinear[256];
+		std::uint16_t thresholds[255];
+
+		SRGBTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				double c = i / 255.0;
+				double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+				toLinear[i] = static_cast<std::uint16_t>(linear * 65535.0 + 0.5);
+			}
+			for (int i = 0; i < 255; i++)
+				thresholds[i] = static_cast<std::uint16_t>((toLinear[i] + toLinear[i + 1] + 1) / 2);
+		}
+
+		unsigned char ToSRGB(unsigned int linear) const
+		{
+			return static_cast<unsigned char>(std::upper_bound(thresholds, thresholds + 255, linear) - thresholds);
+		}
+	};
+
+	static const SRGBTables& srgbTables()
+	{
+		static SRGBTables tables;
+		return tables;
+	}
+
+	// Odd edges reuse the last row / column
+	static void downsample(const Level& src, Level& dst, unsigned int components)
+	{
+		std::size_t srcStride = static_cast<std::size_t>(src.width) * components;
+
+		for (unsigned int y = 0; y < dst.height; y++)
+		{
+			const unsigned char* row0 = &src.texels[std::min(y * 2, src.height - 1) * srcStride];
+			const unsigned char* row1 = &src.texels[std::min(y * 2 + 1, src.height - 1) * srcStride];
+			unsigned char* out = &dst.texels[static_cast<std::size_t>(y) * dst.width * components];
+
+			unsigned int x = 0;
+#ifdef TOONSHADE_MIPS_SSE2
+			// Two RGBA8 output texels per iteration, from 4 texels on each source row
+			if (components == 4)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i rounding = _mm_set1_epi16(2);
+				for (; x + 1 < dst.width && (x * 2 + 3) < src.width; x += 2)
+				{
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+
+					__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+					__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+					__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+					sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(sum, sum));
+				}
+			}
+#endif
+			for (; x < dst.width; x++)
+			{
+				const unsigned char* a = row0 + std::min(x * 2, src.width - 1) * components;
+				const unsigned char* b = row0 + std::min(x * 2 + 1, src.width - 1) * components;
+				const unsigned char* c = row1 + std::min(x * 2, src.width - 1) * components;
+				const unsigned char* d = row1 + std::min(x * 2 + 1, src.width - 1) * components;
+				for (unsigned int ch = 0; ch < components; ch++)
+					out[x * components + ch] = static_cast<unsigned char>((a[ch] + b[ch] + c[ch] + d[ch] + 2) / 4);
+			}
+		}
+	}
+
+	// Table lookups don't vectorize on SSE2, this one stays scalar
+	static void downsampleSRGB(const Level& src, Level& dst, unsigned int components)
+	{
+		const SRGBTables& tables = srgbTables();
+		std::size_t srcStride = static_cast<std::size_t>(src.width) * components;
+
+		for (unsigned int y = 0; y < dst.height; y++)
+		{
+			const unsigned char* row0 = &src.texels[std::min(y * 2, src.height - 1) * srcStride];
+			const unsigned char* row1 = &src.texels[std::min(y * 2 + 1, src.height - 1) * srcStride];
+			unsigned char* out = &dst.texels[static_cast<std::size_t>(y) * dst.width * components];
+
+			for (unsigned int x = 0; x < dst.width; x++)
+			{
+				const unsigned char* a = row0 + std::min(x * 2, src.width - 1) * components;
+				const unsigned char* b = row0 + std::min(x * 2 + 1, src.width - 1) * components;
+				const unsigned char* c = row1 + std::min(x * 2, src.width - 1) * components;
+				const unsigned char* d = row1 + std::min(x * 2 + 1, src.width - 1) * components;
+
+				for (unsigned int ch = 0; ch < 3; ch++)
+				{
+					unsigned int linear = (tables.toLinear[a[ch]] + tables.toLinear[b[ch]] + tables.toLinear[c[ch]] + tables.toLinear[d[ch]] + 2) / 4;
+					out[x * components + ch] = tables.ToSRGB(linear);
+				}
+				if (components == 4)
+					out[x * components + 3] = static_cast<unsigned char>((a[3] + b[3] + c[3] + d[3] + 2) / 4);
+			}
+		}
+	}
+};
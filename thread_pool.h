@@ -0,0 +1,94 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks from a FIFO queue
+// Tasks must not touch GL, only the thread owning the context may do that.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int threadCount = 0) : stopping(false)
+	{
+		if (threadCount == 0)
+			threadCount = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 1;
+
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.emplace_back([this]() { workerLoop(); });
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			stopping = true;
+		}
+		queueCondition.notify_all();
+
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Process-wide pool used by the asset import paths
+	static ThreadPool& Shared()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	template <typename F>
+	std::future<typename std::result_of<F()>::type> Submit(F&& function)
+	{
+		typedef typename std::result_of<F()>::type Result;
+
+		std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+		std::future<Result> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			tasks.push([task]() { (*task)(); });
+		}
+		queueCondition.notify_one();
+
+		return result;
+	}
+
+	unsigned int Size() const
+	{
+		return static_cast<unsigned int>(workers.size());
+	}
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+
+	std::mutex queueMutex;
+	std::condition_variable queueCondition;
+	bool stopping;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueCondition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty())
+					return;
+
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+};
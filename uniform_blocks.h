@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+// Binding points of the uniform blocks every program shares, fixed by layout (binding = N) in the shaders
+enum UniformBlockBinding : GLuint
+{
+	CAMERA_BLOCK_BINDING = 0,
+	LIGHTS_BLOCK_BINDING = 1
+};
+
+// std140 mirror of the Camera block in phong_light_tex, outline and default
+struct CameraBlock
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 viewPos;
+	float padding;
+};
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 layout of the Camera block");
+
+// Uniform buffer holding one T, created on the first Update (GL thread)
+template <typename T>
+class UniformBlock
+{
+public:
+	explicit UniformBlock(GLuint bindingPoint) : binding(bindingPoint), ID(0), uploads(0) {}
+
+	UniformBlock(const UniformBlock&) = delete;
+	UniformBlock& operator=(const UniformBlock&) = delete;
+
+	// Uploads data and binds the buffer to its binding point
+	void Update(const T& data)
+	{
+		if (ID == 0)
+		{
+			glGenBuffers(1, &ID);
+			glBindBuffer(GL_UNIFORM_BUFFER, ID);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+		}
+		else
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, ID);
+		}
+
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		uploads++;
+
+		Bind();
+	}
+
+	void Bind() const
+	{
+		if (ID != 0)
+			glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+	}
+
+	unsigned long long Uploads() const
+	{
+		return uploads;
+	}
+
+	// Call while the context is still current
+	void Delete()
+	{
+		if (ID != 0)
+			glDeleteBuffers(1, &ID);
+		ID = 0;
+	}
+private:
+	GLuint binding;
+	GLuint ID;
+	unsigned long long uploads;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+// Staging memory for streamed uploads : one persistently mapped, coherent buffer used as a ring. Stage copies a chunk in,
+// the caller points a GL copy at the returned offset (GL_PIXEL_UNPACK_BUFFER for textures, GL_COPY_READ_BUFFER for buffers)
+// and the transfer runs without the driver copying or stalling. Fence() closes the chunks staged so far,
+// their space comes back once the GPU has passed that fence. GL thread only.
+class UploadRing
+{
+public:
+	static const std::size_t INVALID = ~static_cast<std::size_t>(0);
+
+	static UploadRing& Get()
+	{
+		static UploadRing ring;
+		return ring;
+	}
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	// Offset of a copy of bytes in the ring, INVALID while the GPU still reads all the free space (Stalled() then reports it).
+	// Chunks larger than Capacity() never fit, upload those from client memory.
+	std::size_t Stage(const void* data, std::size_t bytes)
+	{
+		if (!create() || bytes > capacity)
+			return INVALID;
+
+		reclaim();
+
+		std::size_t offset = (head + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+		std::size_t skipped = offset - head;
+		if (offset + bytes > capacity)
+		{
+			// Wraps : the tail end of the buffer is given up until the GPU is past it
+			skipped = capacity - head;
+			offset = 0;
+		}
+		if (used + skipped + bytes > capacity)
+		{
+			stalled = true;
+			return INVALID;
+		}
+
+		std::memcpy(mapped + offset, data, bytes);
+		head = offset + bytes;
+		used += skipped + bytes;
+		unfenced += skipped + bytes;
+		stalled = false;
+		return offset;
+	}
+
+	// Closes everything staged since the last call, once per frame after the GL calls reading it
+	void Fence()
+	{
+		if (unfenced == 0)
+			return;
+
+		Region region = { glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), unfenced };
+		regions.push_back(region);
+		unfenced = 0;
+	}
+
+	// The last Stage found no room, later chunks will only fit once the GPU catches up
+	bool Stalled() const
+	{
+		return stalled;
+	}
+
+	GLuint Buffer() const
+	{
+		return buffer;
+	}
+
+	std::size_t Capacity() const
+	{
+		return capacity;
+	}
+
+	// Call while the context is still current
+	void Clear()
+	{
+		for (unsigned int i = 0; i < regions.size(); i++)
+			glDeleteSync(regions[i].fence);
+		regions.clear();
+
+		if (buffer != 0)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			glDeleteBuffers(1, &buffer);
+		}
+		buffer = 0;
+		mapped = nullptr;
+		head = used = unfenced = 0;
+		stalled = false;
+	}
+private:
+	static const std::size_t CAPACITY = 8u << 20;
+	static const std::size_t ALIGNMENT = 16;
+
+	struct Region
+	{
+		GLsync fence;
+		std::size_t bytes;  // staged (and skipped) before the fence
+	};
+
+	GLuint buffer;
+	unsigned char* mapped;
+	std::size_t capacity;
+	std::size_t head;      // next write
+	std::size_t used;      // staged and not yet reclaimed, the free space runs from head to head + capacity - used
+	std::size_t unfenced;  // part of used no fence covers yet
+	std::deque<Region> regions;
+	bool stalled;
+	bool unavailable;      // mapping failed once, everything goes through client memory
+
+	UploadRing() : buffer(0), mapped(nullptr), capacity(0), head(0), used(0), unfenced(0), stalled(false), unavailable(false) {}
+
+	// Created on first use, so that a context is current
+	bool create()
+	{
+		if (buffer != 0)
+			return true;
+		if (unavailable)
+			return false;
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, CAPACITY, nullptr, flags);
+		mapped = static_cast<unsigned char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, CAPACITY, flags));
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		if (!mapped)
+		{
+			std::cout << "ERROR::UPLOAD_RING:: Failed to map the staging buffer" << std::endl;
+			glDeleteBuffers(1, &buffer);
+			buffer = 0;
+			unavailable = true;
+			return false;
+		}
+		capacity = CAPACITY;
+		return true;
+	}
+
+	// Gives back the space of every region the GPU is done with, without waiting
+	void reclaim()
+	{
+		while (!regions.empty())
+		{
+			GLenum status = glClientWaitSync(regions.front().fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+
+			glDeleteSync(regions.front().fence);
+			used -= regions.front().bytes;
+			regions.pop_front();
+		}
+
+		// Nothing in flight : start over at the front rather than wrap later
+		if (used == 0)
+			head = 0;
+	}
+};
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Full precision vertex produced by the importer and stored in the MeshCache
+struct Vertex
+{
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+enum class PositionEncoding : std::uint8_t
+{
+	Float,    // 3 x float
+	Half,     // 3 x half, relative to the AABB center
+	Snorm16   // 3 x int16, normalized to the AABB
+};
+
+enum class NormalEncoding : std::uint8_t
+{
+	Float,        // 3 x float
+	Oct16,        // octahedral, 2 x snorm16
+	Packed1010102 // GL_INT_2_10_10_10_REV
+};
+
+enum class UVEncoding : std::uint8_t
+{
+	Float,   // 2 x float
+	Half,    // 2 x half
+	Unorm16  // 2 x unorm16, only when every UV is inside [0, 1] (falls back to Half otherwise)
+};
+
+// GPU layout of a mesh's vertices, every attribute starts on a 4-byte boundary
+struct VertexFormat
+{
+	PositionEncoding position;
+	NormalEncoding normal;
+	UVEncoding uv;
+
+	// The original 32-byte layout
+	static VertexFormat Full()
+	{
+		VertexFormat format = { PositionEncoding::Float, NormalEncoding::Float, UVEncoding::Float };
+		return format;
+	}
+
+	// 16 bytes per vertex
+	static VertexFormat Compact()
+	{
+		VertexFormat format = { PositionEncoding::Snorm16, NormalEncoding::Oct16, UVEncoding::Unorm16 };
+		return format;
+	}
+
+	unsigned int PositionBytes() const { return position == PositionEncoding::Float ? 12 : 8; }
+	unsigned int NormalBytes() const { return normal == NormalEncoding::Float ? 12 : 4; }
+	unsigned int UVBytes() const { return uv == UVEncoding::Float ? 8 : 4; }
+	unsigned int Stride() const { return PositionBytes() + NormalBytes() + UVBytes(); }
+
+	bool operator==(const VertexFormat& other) const
+	{
+		return position == other.position && normal == other.normal && uv == other.uv;
+	}
+};
+
+// Per mesh constants the vertex shaders need to undo the quantization
+// Fed as constant vertex attributes (location 3 and 4) by Mesh::DrawBasic, so any shader works without extra uniforms.
+struct VertexDecode
+{
+	glm::vec4 offset;  // xyz added to the position, w = 1 when normals are octahedral
+	glm::vec3 scale;   // position multiplier
+};
+
+// What uploading packed geometry needs, without owning it : a PackedMesh, or the blocks of a MeshCache mapping
+struct PackedGeometry
+{
+	VertexFormat format;
+	VertexDecode decode;
+	GLenum indexType;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	glm::vec3 boundsMin, boundsMax;
+	const unsigned char* vertices;
+	std::size_t vertexBytes;
+	const unsigned char* indices;
+	std::size_t indexBytes;
+};
+
+// Vertices and indices ready for glBufferData, built off the GL thread
+struct PackedMesh
+{
+	VertexFormat format;
+	VertexDecode decode;
+	std::vector<unsigned char> vertices;
+	std::vector<unsigned char> indices;
+	GLenum indexType;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	glm::vec3 boundsMin, boundsMax;  // full precision positions
+
+	// Largest error the encoding introduced on this mesh
+	float positionError;  // model units
+	float normalError;    // degrees
+	float uvError;
+
+	PackedMesh() : format(VertexFormat::Full()), indexType(GL_UNSIGNED_INT), vertexCount(0), indexCount(0), boundsMin(0.0f), boundsMax(0.0f), positionError(0.0f), normalError(0.0f), uvError(0.0f) {}
+
+	PackedGeometry View() const
+	{
+		PackedGeometry view;
+		view.format = format;
+		view.decode = decode;
+		view.indexType = indexType;
+		view.vertexCount = vertexCount;
+		view.indexCount = indexCount;
+		view.boundsMin = boundsMin;
+		view.boundsMax = boundsMax;
+		view.vertices = vertices.data();
+		view.vertexBytes = vertices.size();
+		view.indices = indices.data();
+		view.indexBytes = indices.size();
+		return view;
+	}
+};
+
+class VertexPacker
+{
+public:
+	// Indices are narrowed to 16 bits when the mesh has fewer than 65536 vertices
+	static PackedMesh Pack(const Vertex* vertices, unsigned int vertexCount, const unsigned int* indices, unsigned int indexCount, VertexFormat format)
+	{
+		PackedMesh packed;
+		packed.vertexCount = vertexCount;
+		packed.indexCount = indexCount;
+
+		glm::vec3 boundsMin(0.0f), boundsMax(0.0f);
+		bool uvInRange = true;
+		for (unsigned int i = 0; i < vertexCount; i++)
+		{
+			boundsMin = i == 0 ? vertices[i].position : glm::min(boundsMin, vertices[i].position);
+			boundsMax = i == 0 ? vertices[i].position : glm::max(boundsMax, vertices[i].position);
+			if (vertices[i].uv.x < 0.0f || vertices[i].uv.x > 1.0f || vertices[i].uv.y < 0.0f || vertices[i].uv.y > 1.0f)
+				uvInRange = false;
+		}
+
+		if (format.uv == UVEncoding::Unorm16 && !uvInRange)
+			format.uv = UVEncoding::Half;
+		packed.format = format;
+		packed.boundsMin = boundsMin;
+		packed.boundsMax = boundsMax;
+
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		glm::vec3 halfExtent = glm::max((boundsMax - boundsMin) * 0.5f, glm::vec3(1e-20f));
+
+		packed.decode.offset = glm::vec4(0.0f, 0.0f, 0.0f, format.normal == NormalEncoding::Oct16 ? 1.0f : 0.0f);
+		packed.decode.scale = glm::vec3(1.0f);
+		if (format.position == PositionEncoding::Half)
+		{
+			packed.decode.offset = glm::vec4(center, packed.decode.offset.w);
+		}
+		else if (format.position == PositionEncoding::Snorm16)
+		{
+			packed.decode.offset = glm::vec4(center, packed.decode.offset.w);
+			packed.decode.scale = halfExtent;
+		}
+
+		unsigned int stride = format.Stride();
+		packed.vertices.resize(static_cast<std::size_t>(vertexCount) * stride);
+		for (unsigned int i = 0; i < vertexCount; i++)
+		{
+			const Vertex& vertex = vertices[i];
+			unsigned char* out = &packed.vertices[static_cast<std::size_t>(i) * stride];
+
+			glm::vec3 position = encodePosition(vertex.position, format.position, center, halfExtent, out);
+			out += format.PositionBytes();
+			glm::vec3 normal = encodeNormal(vertex.normal, format.normal, out);
+			out += format.NormalBytes();
+			glm::vec2 uv = encodeUV(vertex.uv, format.uv, out);
+
+			packed.positionError = std::max(packed.positionError, glm::length(position - vertex.position));
+			packed.uvError = std::max(packed.uvError, std::max(std::fabs(uv.x - vertex.uv.x), std::fabs(uv.y - vertex.uv.y)));
+			if (glm::dot(vertex.normal, vertex.normal) > 0.0f && glm::dot(normal, normal) > 0.0f)
+			{
+				glm::vec3 a = glm::normalize(vertex.normal);
+				glm::vec3 b = glm::normalize(normal);
+				float angle = std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b)); // stays accurate for tiny angles, unlike acos
+				packed.normalError = std::max(packed.normalError, glm::degrees(angle));
+			}
+		}
+
+		if (vertexCount < 65536)
+		{
+			packed.indexType = GL_UNSIGNED_SHORT;
+			packed.indices.resize(static_cast<std::size_t>(indexCount) * sizeof(std::uint16_t));
+			for (unsigned int i = 0; i < indexCount; i++)
+			{
+				std::uint16_t index = static_cast<std::uint16_t>(indices[i]);
+				std::memcpy(&packed.indices[i * sizeof(std::uint16_t)], &index, sizeof(index));
+			}
+		}
+		else
+		{
+			packed.indexType = GL_UNSIGNED_INT;
+			packed.indices.resize(static_cast<std::size_t>(indexCount) * sizeof(unsigned int));
+			if (indexCount != 0)
+				std::memcpy(packed.indices.data(), indices, packed.indices.size());
+		}
+
+		return packed;
+	}
+
+	// GL thread, with the VAO and vertex buffer bound
+	static void SetupAttributes(const VertexFormat& format)
+	{
+		GLsizei stride = static_cast<GLsizei>(format.Stride());
+		const char* offset = nullptr;
+
+		glEnableVertexAttribArray(0);
+		if (format.position == PositionEncoding::Float)
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, offset);
+		else if (format.position == PositionEncoding::Half)
+			glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride, offset);
+		else
+			glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, stride, offset);
+		offset += format.PositionBytes();
+
+		glEnableVertexAttribArray(1);
+		if (format.normal == NormalEncoding::Float)
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, offset);
+		else if (format.normal == NormalEncoding::Oct16)
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, stride, offset);
+		else
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, offset);
+		offset += format.NormalBytes();
+
+		glEnableVertexAttribArray(2);
+		if (format.uv == UVEncoding::Float)
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, offset);
+		else if (format.uv == UVEncoding::Half)
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, offset);
+		else
+			glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, offset);
+	}
+private:
+	static std::int16_t toSnorm16(float value)
+	{
+		return static_cast<std::int16_t>(std::floor(glm::clamp(value, -1.0f, 1.0f) * 32767.0f + 0.5f));
+	}
+
+	static float fromSnorm16(std::int16_t value)
+	{
+		return std::max(value / 32767.0f, -1.0f);
+	}
+
+	static std::uint16_t toHalf(float value)
+	{
+		std::uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+
+		std::uint32_t sign = (bits >> 16) & 0x8000;
+		std::int32_t exponent = static_cast<std::int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+		std::uint32_t mantissa = bits & 0x7FFFFF;
+
+		if (exponent <= 0)
+		{
+			if (exponent < -10)
+				return static_cast<std::uint16_t>(sign);
+			mantissa |= 0x800000;
+			std::uint32_t shift = static_cast<std::uint32_t>(14 - exponent);
+			std::uint32_t half = mantissa >> shift;
+			if ((mantissa >> (shift - 1)) & 1)
+				half++;
+			return static_cast<std::uint16_t>(sign | half);
+		}
+		if (exponent >= 31)
+			return static_cast<std::uint16_t>(sign | 0x7BFF); // clamp to the largest finite half
+
+		std::uint32_t half = sign | (static_cast<std::uint32_t>(exponent) << 10) | (mantissa >> 13);
+		if (mantissa & 0x1000)
+			half++; // round half up, may carry into the exponent which is still correct
+		return static_cast<std::uint16_t>(half);
+	}
+
+	static float fromHalf(std::uint16_t half)
+	{
+		std::uint32_t exponent = (half >> 10) & 0x1F;
+		std::uint32_t mantissa = half & 0x3FF;
+		float value = exponent == 0 ? std::ldexp(static_cast<float>(mantissa), -24) : std::ldexp(static_cast<float>(mantissa | 0x400), static_cast<int>(exponent) - 25);
+		return (half & 0x8000) ? -value : value;
+	}
+
+	// Each encoder writes its attribute and returns what the shader will decode
+	static glm::vec3 encodePosition(const glm::vec3& position, PositionEncoding encoding, const glm::vec3& center, const glm::vec3& halfExtent, unsigned char* out)
+	{
+		if (encoding == PositionEncoding::Float)
+		{
+			std::memcpy(out, &position, sizeof(position));
+			return position;
+		}
+
+		std::int16_t values[4] = { 0, 0, 0, 0 };
+		glm::vec3 decoded;
+		for (int c = 0; c < 3; c++)
+		{
+			if (encoding == PositionEncoding::Half)
+			{
+				std::uint16_t half = toHalf(position[c] - center[c]);
+				std::memcpy(&values[c], &half, sizeof(half));
+				decoded[c] = center[c] + fromHalf(half);
+			}
+			else
+			{
+				values[c] = toSnorm16((position[c] - center[c]) / halfExtent[c]);
+				decoded[c] = center[c] + fromSnorm16(values[c]) * halfExtent[c];
+			}
+		}
+		std::memcpy(out, values, sizeof(values));
+		return decoded;
+	}
+
+	static glm::vec3 encodeNormal(const glm::vec3& normal, NormalEncoding encoding, unsigned char* out)
+	{
+		if (encoding == NormalEncoding::Float)
+		{
+			std::memcpy(out, &normal, sizeof(normal));
+			return normal;
+		}
+
+		float length = glm::length(normal);
+		glm::vec3 n = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+
+		if (encoding == NormalEncoding::Packed1010102)
+		{
+			std::uint32_t packed = 0;
+			glm::vec3 decoded;
+			for (int c = 0; c < 3; c++)
+			{
+				int value = static_cast<int>(std::floor(glm::clamp(n[c], -1.0f, 1.0f) * 511.0f + 0.5f));
+				packed |= (static_cast<std::uint32_t>(value) & 0x3FF) << (c * 10);
+				decoded[c] = std::max(value / 511.0f, -1.0f);
+			}
+			std::memcpy(out, &packed, sizeof(packed));
+			return decoded;
+		}
+
+		// Octahedral : project onto |x| + |y| + |z| = 1 and fold the lower hemisphere,
+		// then keep whichever of the 4 neighbouring snorm16 pairs decodes closest
+		glm::vec2 p = glm::vec2(n.x, n.y) / (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+		if (n.z < 0.0f)
+			p = (glm::vec2(1.0f) - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+
+		std::int16_t best[2] = { 0, 0 };
+		glm::vec3 bestDecoded(0.0f);
+		float bestDot = -2.0f;
+		for (int i = 0; i < 4; i++)
+		{
+			std::int16_t candidate[2];
+			for (int c = 0; c < 2; c++)
+			{
+				float scaled = glm::clamp(p[c], -1.0f, 1.0f) * 32767.0f;
+				float rounded = ((i >> c) & 1) ? std::ceil(scaled) : std::floor(scaled);
+				candidate[c] = static_cast<std::int16_t>(glm::clamp(rounded, -32767.0f, 32767.0f));
+			}
+
+			glm::vec3 decoded = octDecode(fromSnorm16(candidate[0]), fromSnorm16(candidate[1]));
+			float d = glm::dot(decoded, n);
+			if (d > bestDot)
+			{
+				bestDot = d;
+				best[0] = candidate[0];
+				best[1] = candidate[1];
+				bestDecoded = decoded;
+			}
+		}
+
+		std::memcpy(out, best, sizeof(best));
+		return bestDecoded;
+	}
+
+	// Same as decodeNormal() in the vertex shaders
+	static glm::vec3 octDecode(float x, float y)
+	{
+		glm::vec3 n(x, y, 1.0f - std::fabs(x) - std::fabs(y));
+		if (n.z < 0.0f)
+		{
+			float foldedX = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+			float foldedY = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+			n.x = foldedX;
+			n.y = foldedY;
+		}
+		return glm::normalize(n);
+	}
+
+	static glm::vec2 encodeUV(const glm::vec2& uv, UVEncoding encoding, unsigned char* out)
+	{
+		if (encoding == UVEncoding::Float)
+		{
+			std::memcpy(out, &uv, sizeof(uv));
+			return uv;
+		}
+
+		std::uint16_t values[2];
+		glm::vec2 decoded;
+		for (int c = 0; c < 2; c++)
+		{
+			if (encoding == UVEncoding::Half)
+			{
+				values[c] = toHalf(uv[c]);
+				decoded[c] = fromHalf(values[c]);
+			}
+			else
+			{
+				values[c] = static_cast<std::uint16_t>(std::floor(glm::clamp(uv[c], 0.0f, 1.0f) * 65535.0f + 0.5f));
+				decoded[c] = values[c] / 65535.0f;
+			}
+		}
+		std::memcpy(out, values, sizeof(values));
+		return decoded;
+	}
+};
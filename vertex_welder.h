@@ -0,0 +1,249 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <vector>
+
+#include "thread_pool.h"
+#include "vertex_format.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TOONSHADE_WELD_SSE2
+#endif
+
+// Merges vertices whose position, normal and UV land on the same point of a grid with the given spacing,
+// the hash grid replacing aiProcess_JoinIdenticalVertices. The first vertex of each group (in index order)
+// is the one kept, vertices keep their relative order and indices are rewritten in place.
+class VertexWelder
+{
+public:
+	struct Tolerance
+	{
+		float position;  // model units
+		float normal;    // per component of the unit normal
+		float uv;        // 0 (or less) in any of them : that attribute must match exactly
+
+		Tolerance() : position(1e-5f), normal(1e-3f), uv(1e-5f) {}
+	};
+
+	struct Report
+	{
+		unsigned int before;
+		unsigned int after;
+		double ms;
+	};
+
+	// Below this many vertices a mesh is welded on the calling thread even when a pool is given
+	static const unsigned int PARALLEL_MIN_VERTICES = 32768;
+
+	// Hashing and lookups are spread over the pool when one is given, never pass a pool from inside one of its own tasks
+	static Report Weld(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, const Tolerance& tolerance, ThreadPool* pool = nullptr)
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+		Report report;
+		report.before = static_cast<unsigned int>(vertices.size());
+		report.after = report.before;
+		report.ms = 0.0;
+
+		unsigned int vertexCount = static_cast<unsigned int>(vertices.size());
+		if (vertexCount == 0)
+			return report;
+
+		if (vertexCount < PARALLEL_MIN_VERTICES)
+			pool = nullptr;
+		unsigned int chunks = pool ? pool->Size() + 1 : 1;
+
+		// 1. Grid cell of every vertex, with its hash. A scale of 0 marks an exact component (see quantize).
+		std::vector<Key> keys(vertexCount);
+		std::vector<std::uint32_t> hashes(vertexCount);
+		const float positionScale = gridScale(tolerance.position);
+		const float normalScale = gridScale(tolerance.normal);
+		const float uvScale = gridScale(tolerance.uv);
+		const float scale[8] = {
+			positionScale, positionScale, positionScale,
+			normalScale, normalScale, normalScale,
+			uvScale, uvScale
+		};
+		parallelFor(pool, chunks, vertexCount, [&](unsigned int first, unsigned int last)
+		{
+			for (unsigned int i = first; i < last; i++)
+			{
+				quantize(vertices[i], scale, keys[i]);
+				hashes[i] = hash(keys[i]);
+			}
+		});
+
+		// 2. Each chunk owns the cells whose hash falls in its partition, so the tables never need a lock
+		std::vector<unsigned int> representative(vertexCount);
+		parallelFor(pool, chunks, chunks, [&](unsigned int first, unsigned int last)
+		{
+			const unsigned int empty = 0xFFFFFFFFu;
+			std::vector<unsigned int> members;
+			std::vector<unsigned int> table;
+			for (unsigned int partition = first; partition < last; partition++)
+			{
+				members.clear();
+				for (unsigned int i = 0; i < vertexCount; i++)
+				{
+					if (hashes[i] % chunks == partition)
+						members.push_back(i);
+				}
+
+				unsigned int tableSize = 16;
+				while (tableSize < members.size() * 2)
+					tableSize *= 2;
+				table.assign(tableSize, empty);
+
+				for (unsigned int m = 0; m < members.size(); m++)
+				{
+					unsigned int i = members[m];
+					unsigned int slot = (hashes[i] / chunks) & (tableSize - 1);
+					while (table[slot] != empty && !(keys[table[slot]] == keys[i]))
+						slot = (slot + 1) & (tableSize - 1);
+
+					if (table[slot] == empty)
+						table[slot] = i;
+					representative[i] = table[slot];
+				}
+			}
+		});
+
+		// 3. Compact, representatives always come before the vertices merged into them
+		std::vector<unsigned int> remap(vertexCount);
+		unsigned int written = 0;
+		for (unsigned int i = 0; i < vertexCount; i++)
+		{
+			if (representative[i] == i)
+			{
+				vertices[written] = vertices[i];
+				remap[i] = written++;
+			}
+			else
+			{
+				remap[i] = remap[representative[i]];
+			}
+		}
+		vertices.resize(written);
+
+		unsigned int indexCount = static_cast<unsigned int>(indices.size());
+		parallelFor(pool, chunks, indexCount, [&](unsigned int first, unsigned int last)
+		{
+			for (unsigned int i = first; i < last; i++)
+				indices[i] = remap[indices[i]];
+		});
+
+		report.after = written;
+		report.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return report;
+	}
+private:
+	// Position, normal and UV rounded to grid steps
+	struct Key
+	{
+		std::int32_t q[8];
+
+		bool operator==(const Key& other) const
+		{
+			for (unsigned int i = 0; i < 8; i++)
+			{
+				if (q[i] != other.q[i])
+					return false;
+			}
+			return true;
+		}
+	};
+
+	static float gridScale(float tolerance)
+	{
+		return tolerance > 0.0f ? 1.0f / tolerance : 0.0f;
+	}
+
+	static void quantize(const Vertex& vertex, const float scale[8], Key& key)
+	{
+		static_assert(sizeof(Vertex) == sizeof(float) * 8, "Vertex is expected to be 8 tightly packed floats");
+		const float* values = &vertex.position.x;
+		const float gridLimit = 1073741824.0f;  // clamped so far-off values saturate the same way on both paths
+
+#ifdef TOONSHADE_WELD_SSE2
+		const __m128 limit = _mm_set1_ps(gridLimit);
+		const __m128 negativeLimit = _mm_set1_ps(-gridLimit);
+		for (unsigned int half = 0; half < 2; half++)
+		{
+			__m128 scaled = _mm_mul_ps(_mm_loadu_ps(values + half * 4), _mm_loadu_ps(scale + half * 4));
+			scaled = _mm_max_ps(_mm_min_ps(scaled, limit), negativeLimit);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(key.q + half * 4), _mm_cvtps_epi32(scaled));
+		}
+#else
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			float scaled = values[i] * scale[i];
+			if (scaled != scaled)
+			{
+				key.q[i] = 0;  // NaN (or inf * 0), settled below
+				continue;
+			}
+			scaled = std::max(std::min(scaled, gridLimit), -gridLimit);
+			key.q[i] = static_cast<std::int32_t>(std::nearbyint(scaled));  // round half to even, as _mm_cvtps_epi32
+		}
+#endif
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			// Exact component : its bit pattern is the cell, with -0 folded into +0
+			if (scale[i] == 0.0f)
+			{
+				float value = values[i] + 0.0f;
+				std::memcpy(&key.q[i], &value, sizeof(float));
+			}
+
+			// -0 and +0 round to the same cell already, NaN would not : send it to cell 0
+			if (values[i] != values[i])
+				key.q[i] = 0;
+		}
+	}
+
+	static std::uint32_t hash(const Key& key)
+	{
+		std::uint32_t h = 2166136261u;
+		for (unsigned int i = 0; i < 8; i++)
+		{
+			h ^= static_cast<std::uint32_t>(key.q[i]);
+			h *= 16777619u;
+			h ^= h >> 15;
+		}
+		return h;
+	}
+
+	// Splits [0, count) into chunks, the first one runs on the calling thread
+	template <typename F>
+	static void parallelFor(ThreadPool* pool, unsigned int chunks, unsigned int count, const F& function)
+	{
+		if (!pool || count < 2)
+		{
+			function(0, count);
+			return;
+		}
+
+		chunks = std::min(chunks, count);
+		unsigned int perChunk = (count + chunks - 1) / chunks;
+
+		std::vector<std::future<void>> pending;
+		for (unsigned int first = perChunk; first < count; first += perChunk)
+		{
+			unsigned int last = std::min(count, first + perChunk);
+			pending.push_back(pool->Submit([&function, first, last]() { function(first, last); }));
+		}
+
+		function(0, std::min(count, perChunk));
+
+		for (unsigned int i = 0; i < pending.size(); i++)
+			pending[i].get();
+	}
+};